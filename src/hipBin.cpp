@@ -24,6 +24,7 @@ THE SOFTWARE.
 #include "hipBin_amd.h"
 #include "hipBin_nvidia.h"
 #include "hipBin_spirv.h"
+#include "hipBin_record.h"
 #include <vector>
 #include <string>
 
@@ -52,6 +53,8 @@ class HipBin {
   void executeHipBin(string filename, int argc, char* argv[]);
   void executeHipConfig(int argc, char* argv[]);
   void executeHipCC(int argc, char* argv[]);
+  void executeHipCCPlatforms(const vector<string>& argvcc,
+                             HipccOptions options);
 };
 
 
@@ -141,14 +144,119 @@ void HipBin::executeHipCC(int argc, char* argv[]) {
   for (int i = 0; i < argc; i++) {
     argvcc.push_back(argv[i]);
   }
+  const EnvVariables& var = platformPtrs.at(0)->getEnvVariables();
+  HipBinRecorder recorder(hipBinUtilPtr_);
+  // --hipcc-replay[=plan|=full] <file> re-runs the recorded invocations
+  if (argvcc.size() > 1 && hipBinUtilPtr_->stringRegexMatch(
+      argvcc.at(1), "^--hipcc-replay(=plan|=full)?$")) {
+    if (argvcc.size() < 3) {
+      cout << "usage: hipcc --hipcc-replay[=plan|=full] <record file>"
+           << endl;
+      exit(-1);
+    }
+    vector<string> envNames;
+    for (auto& envVar : EnvVariables().toList())
+      envNames.push_back(envVar.first);
+    exit(recorder.replay(argvcc.at(2), argvcc.at(1) == "--hipcc-replay=full",
+                         envNames));
+  }
+  // --hipcc-cache-server <dir> [port] serves a remote cache directory
+  if (argvcc.size() > 1 && argvcc.at(1) == "--hipcc-cache-server") {
+    if (argvcc.size() < 3) {
+      cout << "usage: hipcc --hipcc-cache-server <dir> [port]" << endl;
+      exit(-1);
+    }
+    int port = argvcc.size() > 3 ? std::atoi(argvcc.at(3).c_str()) : 8080;
+    exit(HipBinHttpServer(argvcc.at(2)).serve(port));
+  }
+  if (!var.hipccRecordEnv_.empty()) {
+    recorder.record(var.hipccRecordEnv_, argvcc, var.toList());
+  }
+  HipccOptions options;
+  for (auto arg = argvcc.begin() + 1; arg != argvcc.end();) {
+    if (*arg == "--hipcc-fingerprint") {
+      options.fingerprint = true;
+      arg = argvcc.erase(arg);
+    } else if (*arg == "--hipcc-skip-up-to-date") {
+      options.skipUpToDate = true;
+      arg = argvcc.erase(arg);
+    } else if (*arg == "--hipcc-unity" ||
+               arg->compare(0, 14, "--hipcc-unity=") == 0) {
+      options.unity = arg->size() > 14 ? std::atoi(arg->c_str() + 14) : 0;
+      if (options.unity <= 0)
+        options.unity = HIPCC_UNITY_DEFAULT_SIZE;
+      arg = argvcc.erase(arg);
+    } else if (arg->compare(0, 12, "--hipcc-pgo=") == 0) {
+      size_t colon = arg->find(':');
+      options.pgo = arg->substr(12, colon == string::npos ? string::npos :
+                                colon - 12);
+      if ((options.pgo != "generate" && options.pgo != "use") ||
+          colon == string::npos || colon + 1 == arg->size()) {
+        cout << "usage: hipcc --hipcc-pgo=generate:<dir> or "
+             << "--hipcc-pgo=use:<dir>" << endl;
+        exit(-1);
+      }
+      std::error_code ec;
+      options.pgoDir = fs::absolute(arg->substr(colon + 1), ec).string();
+      arg = argvcc.erase(arg);
+    } else if (arg->compare(0, 18, "--hipcc-platforms=") == 0) {
+      options.platforms = hipBinUtilPtr_->splitStr(arg->substr(18), ',');
+      arg = argvcc.erase(arg);
+    } else {
+      ++arg;
+    }
+  }
+  for (auto platformPtr : platformPtrs)
+    platformPtr->setHipccOptions(options);
+  if (!options.platforms.empty()) {
+    executeHipCCPlatforms(argvcc, options);
+    return;
+  }
   // 0th index points to the first platform detected.
   // In the near future this vector will contain mulitple devices
   platformPtrs.at(0)->executeHipCCCmd(argvcc);
 }
 
+// --hipcc-platforms=<platform>,... compiles the device code of each platform
+// with its own command, and the host code with the first one's. The other
+// platforms only construct their commands.
+void HipBin::executeHipCCPlatforms(const vector<string>& argvcc,
+                                   HipccOptions options) {
+  vector<HipBinBase*> selected;
+  for (auto& name : options.platforms) {
+    HipBinBase* platformPtr = nullptr;
+    if (name == "amd")
+      platformPtr = hipBinAMDPtr_;
+    else if (name == "spirv" || name == "intel")
+      platformPtr = hipBinSPIRVPtr_;
+    if (!platformPtr) {
+      cout << "hipcc: unknown platform " << name
+           << " in --hipcc-platforms, use amd or spirv" << endl;
+      exit(-1);
+    }
+    if (std::find(selected.begin(), selected.end(), platformPtr) ==
+        selected.end())
+      selected.push_back(platformPtr);
+  }
+  HipccOptions commandOptions = options;
+  commandOptions.commandOnly = true;
+  for (size_t i = 1; i < selected.size(); i++) {
+    selected[i]->setHipccOptions(commandOptions);
+    selected[i]->executeHipCCCmd(argvcc);
+    if (!selected[i]->getCommand().empty())
+      options.deviceCommands.push_back(selected[i]->getCommand());
+  }
+  selected[0]->setHipccOptions(options);
+  selected[0]->executeHipCCCmd(argvcc);
+}
+
 
 void HipBin::executeHipConfig(int argc, char* argv[]) {
   vector<HipBinBase*>& platformPtrs = getHipBinPtrs();
+  vector<string> platformNames;
+  for (auto& platformPtr : platformPtrs)
+    platformNames.push_back(PlatformTypeStr(
+                            platformPtr->getPlatformInfo().platform));
   for (unsigned int j = 0; j < platformPtrs.size(); j++) {
     if (argc == 1) {
       platformPtrs.at(j)->printFull();
@@ -186,6 +294,11 @@ void HipBin::executeHipConfig(int argc, char* argv[]) {
       case newline:
         cout << endl;
         break;
+      // one document for all platforms, with the values of the first
+      case json:
+        if (j == 0)
+          platformPtrs.at(j)->printJson(platformNames);
+        break;
       default:
         platformPtrs.at(j)->printUsage();
         break;
@@ -48,6 +48,7 @@ class HipBinAmd : public HipBinBase {
   string hipCFlags_, hipCXXFlags_, hipLdFlags_;
   void constructRocclrHomePath();
   void constructHsaPath();
+  string getDefaultTargets();
 
  public:
   HipBinAmd();
@@ -58,7 +59,7 @@ class HipBinAmd : public HipBinBase {
   virtual const PlatformInfo& getPlatformInfo() const;
   virtual string getCppConfig();
   virtual void printFull();
-  virtual void printCompilerInfo() const;
+  virtual void printCompilerInfo();
   virtual string getCompilerVersion();
   virtual void checkHipconfig();
   virtual string getDeviceLibPath() const;
@@ -73,6 +74,7 @@ class HipBinAmd : public HipBinBase {
   virtual const string& getHipCFlags() const;
   virtual const string& getHipLdFlags() const;
   virtual void executeHipCCCmd(vector<string> argv);
+  virtual vector<string> getOffloadArchs();
   // non virtual functions
   const string& getHsaPath() const;
   const string& getRocclrHomePath() const;
@@ -258,36 +260,20 @@ const string& HipBinAmd::getCompilerPath() const {
   return hipClangPath_;
 }
 
-void HipBinAmd::printCompilerInfo() const {
+// prints the tool versions and the flags hipcc adds, which are computed
+// here instead of running hipcc --cxxflags and --ldflags
+void HipBinAmd::printCompilerInfo() {
   const OsType& os = getOSInfo();
   const string& hipClangPath = getCompilerPath();
-  const string& hipPath = getHipPath();
-  if (os == windows) {
-    string cmd = hipClangPath + "/clang++ --version";
-    system(cmd.c_str());  // hipclang version
+  cout << runProbe(hipClangPath + "/clang++ --version 2>&1").out;
+  if (os == windows)
     cout << "llc-version :" << endl;
-    cmd = hipClangPath + "/llc --version";
-    system(cmd.c_str());  // llc version
-    cout << "hip-clang-cxxflags :" << endl;
-    cmd = hipPath + "/bin/hipcc  --cxxflags";
-    system(cmd.c_str());  // cxx flags
-    cout << endl << "hip-clang-ldflags :" << endl;
-    cmd = hipPath + "/bin/hipcc --ldflags";
-    system(cmd.c_str());  // ld flags
-    cout << endl;
-  } else {
-    string cmd = hipClangPath + "/clang++ --version";
-    system(cmd.c_str());  // hipclang version
-    cmd = hipClangPath + "/llc --version";
-    system(cmd.c_str());  // llc version
-    cout << "hip-clang-cxxflags :" << endl;
-    cmd = hipPath + "/bin/hipcc --cxxflags";
-    system(cmd.c_str());  // cxx flags
-    cout << endl << "hip-clang-ldflags :" << endl;
-    cmd = hipPath + "/bin/hipcc --ldflags";
-    system(cmd.c_str());  // ldflags version
-    cout << endl;
-  }
+  cout << runProbe(hipClangPath + "/llc --version 2>&1").out;
+  cout << "hip-clang-cxxflags :" << endl;
+  executeHipCCCmd({"hipcc", "--cxxflags"});
+  cout << endl << "hip-clang-ldflags :" << endl;
+  executeHipCCCmd({"hipcc", "--ldflags"});
+  cout << endl;
 }
 
 string HipBinAmd::getCompilerVersion() {
@@ -482,7 +468,14 @@ void HipBinAmd::checkHipconfig() {
   }
 }
 
+// the tool queries run in the background while the rest is printed
 void HipBinAmd::printFull() {
+  const string& clangPath = getCompilerPath();
+  vector<string> probes = { clangPath + "/clang++ --version 2>&1",
+                            clangPath + "/llc --version 2>&1" };
+  if (getOSInfo() != windows && getEnvVariables().hccAmdGpuTargetEnv_.empty())
+    probes.push_back(getRoccmPath() + "/bin/rocm_agent_enumerator -t GPU");
+  startProbes(probes);
   const string& hipVersion = getHipVersion();
   const string& hipPath = getHipPath();
   const string& roccmPath = getRoccmPath();
@@ -510,12 +503,36 @@ void HipBinAmd::printFull() {
   cout << endl << "== Envirnoment Variables" << endl;
   printEnvironmentVariables();
   getSystemInfo();
-  if (fs::exists("/usr/bin/lsb_release"))
-    system("/usr/bin/lsb_release -a");
+  printOsRelease();
   cout << endl;
 }
 
 
+// the comma separated targets used without --offload-arch: HCC_AMDGPU_TARGET
+// or the GPUs listed by rocm_agent_enumerator, which is run once
+string HipBinAmd::getDefaultTargets() {
+  const EnvVariables& var = getEnvVariables();
+  if (!var.hccAmdGpuTargetEnv_.empty())
+    return var.hccAmdGpuTargetEnv_;
+  if (getOSInfo() == windows)
+    return "";
+  string enumerator = getRoccmPath() + "/bin/rocm_agent_enumerator -t GPU";
+  startProbes({enumerator});
+  SystemCmdOut sysOut = runProbe(enumerator);
+  regex toReplace("\n+");
+  return hipBinUtilPtr_->replaceRegex(sysOut.out, toReplace, ",");
+}
+
+// the default targets, without the gfx000 of rocm_agent_enumerator
+vector<string> HipBinAmd::getOffloadArchs() {
+  vector<string> archs;
+  for (auto& target : hipBinUtilPtr_->splitStr(getDefaultTargets(), ',')) {
+    if (!target.empty() && target != "gfx000")
+      archs.push_back(target);
+  }
+  return archs;
+}
+
 void HipBinAmd::executeHipCCCmd(vector<string> argv) {
   if (argv.size() < 2) {
     cout<< "No Arguments passed, exiting ...\n";
@@ -992,17 +1009,7 @@ void HipBinAmd::executeHipCCCmd(vector<string> argv) {
   }  // end of for loop
   // No AMDGPU target specified at commandline. So look for HCC_AMDGPU_TARGET
   if (default_amdgpu_target == 1) {
-    if (!var.hccAmdGpuTargetEnv_.empty()) {
-      targetsStr = var.hccAmdGpuTargetEnv_;
-    } else if (os != windows) {
-      // Else try using rocm_agent_enumerator
-      string ROCM_AGENT_ENUM;
-      ROCM_AGENT_ENUM = roccmPath + "/bin/rocm_agent_enumerator";
-      targetsStr = ROCM_AGENT_ENUM +" -t GPU";
-      SystemCmdOut sysOut = hipBinUtilPtr_->exec(targetsStr.c_str());
-      regex toReplace("\n+");
-      targetsStr = hipBinUtilPtr_->replaceRegex(sysOut.out, toReplace, ",");
-    }
+    targetsStr = getDefaultTargets();
     default_amdgpu_target = 0;
   }
   // Parse the targets collected in targetStr
@@ -1114,6 +1121,10 @@ void HipBinAmd::executeHipCCCmd(vector<string> argv) {
     toolArgs += " -L" + hipClangPath + "/../lib/clang/" +
                 hipClangVersion + "/lib/linux -lclang_rt.builtins-x86_64 ";
   }
+  // location independent outputs (HIPCC_BASE_DIR)
+  string prefixMapFlags = getPrefixMapFlags({hipPath, roccmPath});
+  HIPCXXFLAGS = normalizeIncludePaths(HIPCXXFLAGS) + prefixMapFlags;
+  HIPCFLAGS = normalizeIncludePaths(HIPCFLAGS) + prefixMapFlags;
   if (!var.hipccCompileFlagsAppendEnv_.empty()) {
     HIPCXXFLAGS += " " + var.hipccCompileFlagsAppendEnv_ + " ";
     HIPCFLAGS += " " + var.hipccCompileFlagsAppendEnv_ + " ";
@@ -1155,14 +1166,10 @@ void HipBinAmd::executeHipCCCmd(vector<string> argv) {
     cout << HIPLDFLAGS;
   }
   if (runCmd) {
-    SystemCmdOut sysOut;
-    sysOut = hipBinUtilPtr_->exec(CMD.c_str(), true);
-    string cmdOut = sysOut.out;
-    int CMD_EXIT_CODE = sysOut.exitCode;
-    if (CMD_EXIT_CODE !=0) {
-      cout <<  "failed to execute:"  << CMD << std::endl;
-    }
-    exit(CMD_EXIT_CODE);
+    vector<string> userArgs(argv.begin() + 1, argv.end());
+    int exitCode = runHipCCCmd(CMD, userArgs);
+    if (!getHipccOptions().commandOnly)
+      exit(exitCode);
   }  // end of runCmd section
 }   // end of function
 
@@ -24,9 +24,27 @@ THE SOFTWARE.
 
 
 #include "hipBin_util.h"
+#include "hipBin_job.h"
+#include "hipBin_cache.h"
+#include "hipBin_singleflight.h"
+#include "hipBin_prefetch.h"
+#include "hipBin_plan.h"
+#include "hipBin_split.h"
+#include "hipBin_pch.h"
+#include "hipBin_unity.h"
+#include "hipBin_scan.h"
+#include "hipBin_pgo.h"
+#include "hipBin_link.h"
+#include "hipBin_linker.h"
+#include <future>
 #include <vector>
 #include <string>
 
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/utsname.h>
+extern char** environ;
+#endif
+
 // All envirnoment variables used in the code
 # define PATH                       "PATH"
 # define HIP_ROCCLR_HOME            "HIP_ROCCLR_HOME"
@@ -49,6 +67,30 @@ THE SOFTWARE.
 # define HIP_COMPILE_CXX_AS_HIP         "HIP_COMPILE_CXX_AS_HIP"
 # define HIPCC_VERBOSE                  "HIPCC_VERBOSE"
 # define HCC_AMDGPU_TARGET              "HCC_AMDGPU_TARGET"
+# define HIPCC_RECORD                   "HIPCC_RECORD"
+# define HIPCC_PLAN_ONLY                "HIPCC_PLAN_ONLY"
+# define HIPCC_CACHE_DIR                "HIPCC_CACHE_DIR"
+# define HIPCC_CACHE_MAXSIZE            "HIPCC_CACHE_MAXSIZE"
+# define HIPCC_SINGLE_FLIGHT_DIR        "HIPCC_SINGLE_FLIGHT_DIR"
+# define HIPCC_REMOTE_CACHE             "HIPCC_REMOTE_CACHE"
+# define HIPCC_REMOTE_CACHE_TIMEOUT     "HIPCC_REMOTE_CACHE_TIMEOUT"
+# define HIPCC_BASE_DIR                 "HIPCC_BASE_DIR"
+# define HIPCC_PREFETCH_DIR             "HIPCC_PREFETCH_DIR"
+# define HIPCC_DIRECT_CC1               "HIPCC_DIRECT_CC1"
+# define HIPCC_JOBS                     "HIPCC_JOBS"
+# define HIPCC_SPLIT_COMPILE            "HIPCC_SPLIT_COMPILE"
+# define HIPCC_DEVICE_REUSE             "HIPCC_DEVICE_REUSE"
+# define HIPCC_PCH_DIR                  "HIPCC_PCH_DIR"
+# define HIPCC_SCAN_DIR                 "HIPCC_SCAN_DIR"
+# define HIPCC_SHARED_PREPROCESS        "HIPCC_SHARED_PREPROCESS"
+# define HIPCC_SPIRV_AOT_DEVICES        "HIPCC_SPIRV_AOT_DEVICES"
+# define HIPCC_SPIRV_AOT_TOOL           "HIPCC_SPIRV_AOT_TOOL"
+# define HIPCC_SPIRV_OPT                "HIPCC_SPIRV_OPT"
+# define HIPCC_SPIRV_OPT_DIR            "HIPCC_SPIRV_OPT_DIR"
+# define HIPCC_PARALLEL_LINK            "HIPCC_PARALLEL_LINK"
+# define HIPCC_LINK_PARTITIONS          "HIPCC_LINK_PARTITIONS"
+# define HIPCC_RDC_CACHE_DIR            "HIPCC_RDC_CACHE_DIR"
+# define HIPCC_FAST_LINKER              "HIPCC_FAST_LINKER"
 
 # define HIP_BASE_VERSION_MAJOR     "4"
 # define HIP_BASE_VERSION_MINOR     "4"
@@ -163,6 +205,75 @@ struct EnvVariables {
   string hipClangHccCompactModeEnv_ = "";
   string hipCompileCxxAsHipEnv_ = "";
   string hccAmdGpuTargetEnv_ = "";
+  string hipccRecordEnv_ = "";
+  string hipccPlanOnlyEnv_ = "";
+  string hipccCacheDirEnv_ = "";
+  string hipccCacheMaxSizeEnv_ = "";
+  string hipccSingleFlightDirEnv_ = "";
+  string hipccRemoteCacheEnv_ = "";
+  string hipccRemoteCacheTimeoutEnv_ = "";
+  string hipccBaseDirEnv_ = "";
+  string hipccPrefetchDirEnv_ = "";
+  string hipccDirectCc1Env_ = "";
+  string hipccJobsEnv_ = "";
+  string hipccSplitCompileEnv_ = "";
+  string hipccDeviceReuseEnv_ = "";
+  string hipccPchDirEnv_ = "";
+  string hipccScanDirEnv_ = "";
+  string hipccSharedPreprocessEnv_ = "";
+  string hipccSpirvAotDevicesEnv_ = "";
+  string hipccSpirvAotToolEnv_ = "";
+  string hipccSpirvOptEnv_ = "";
+  string hipccSpirvOptDirEnv_ = "";
+  string hipccParallelLinkEnv_ = "";
+  string hipccLinkPartitionsEnv_ = "";
+  string hipccRdcCacheDirEnv_ = "";
+  string hipccFastLinkerEnv_ = "";
+  // name/value pairs of the variables which influence the hipcc command,
+  // used to record and replay invocations
+  vector<std::pair<string, string>> toList() const {
+    return { {PATH, path_},
+             {HIP_PATH, hipPathEnv_},
+             {HIP_ROCCLR_HOME, hipRocclrPathEnv_},
+             {ROCM_PATH, roccmPathEnv_},
+             {CUDA_PATH, cudaPathEnv_},
+             {HSA_PATH, hsaPathEnv_},
+             {HIP_CLANG_PATH, hipClangPathEnv_},
+             {HIP_PLATFORM, hipPlatformEnv_},
+             {HIP_COMPILER, hipCompilerEnv_},
+             {HIP_RUNTIME, hipRuntimeEnv_},
+             {LD_LIBRARY_PATH, ldLibraryPathEnv_},
+             {HIPCC_VERBOSE, verboseEnv_},
+             {HIPCC_COMPILE_FLAGS_APPEND, hipccCompileFlagsAppendEnv_},
+             {HIPCC_LINK_FLAGS_APPEND, hipccLinkFlagsAppendEnv_},
+             {HIP_LIB_PATH, hipLibPathEnv_},
+             {DEVICE_LIB_PATH, deviceLibPathEnv_},
+             {HIP_CLANG_HCC_COMPAT_MODE, hipClangHccCompactModeEnv_},
+             {HIP_COMPILE_CXX_AS_HIP, hipCompileCxxAsHipEnv_},
+             {HCC_AMDGPU_TARGET, hccAmdGpuTargetEnv_},
+             {HIPCC_CACHE_DIR, hipccCacheDirEnv_},
+             {HIPCC_CACHE_MAXSIZE, hipccCacheMaxSizeEnv_},
+             {HIPCC_SINGLE_FLIGHT_DIR, hipccSingleFlightDirEnv_},
+             {HIPCC_REMOTE_CACHE, hipccRemoteCacheEnv_},
+             {HIPCC_REMOTE_CACHE_TIMEOUT, hipccRemoteCacheTimeoutEnv_},
+             {HIPCC_BASE_DIR, hipccBaseDirEnv_},
+             {HIPCC_PREFETCH_DIR, hipccPrefetchDirEnv_},
+             {HIPCC_DIRECT_CC1, hipccDirectCc1Env_},
+             {HIPCC_JOBS, hipccJobsEnv_},
+             {HIPCC_SPLIT_COMPILE, hipccSplitCompileEnv_},
+             {HIPCC_DEVICE_REUSE, hipccDeviceReuseEnv_},
+             {HIPCC_PCH_DIR, hipccPchDirEnv_},
+             {HIPCC_SCAN_DIR, hipccScanDirEnv_},
+             {HIPCC_SHARED_PREPROCESS, hipccSharedPreprocessEnv_},
+             {HIPCC_SPIRV_AOT_DEVICES, hipccSpirvAotDevicesEnv_},
+             {HIPCC_SPIRV_AOT_TOOL, hipccSpirvAotToolEnv_},
+             {HIPCC_SPIRV_OPT, hipccSpirvOptEnv_},
+             {HIPCC_SPIRV_OPT_DIR, hipccSpirvOptDirEnv_},
+             {HIPCC_PARALLEL_LINK, hipccParallelLinkEnv_},
+             {HIPCC_LINK_PARTITIONS, hipccLinkPartitionsEnv_},
+             {HIPCC_RDC_CACHE_DIR, hipccRdcCacheDirEnv_},
+             {HIPCC_FAST_LINKER, hipccFastLinkerEnv_} };
+  }
   friend std::ostream& operator <<(std::ostream& os, const EnvVariables& var) {
     os << "Path: "                           << var.path_ << endl;
     os << "Hip Path: "                       << var.hipPathEnv_ << endl;
@@ -187,10 +298,62 @@ struct EnvVariables {
     os << "Hip Compile Cxx as Hip: "         <<
            var.hipCompileCxxAsHipEnv_ << endl;
     os << "Hcc Amd Gpu Target: "             << var.hccAmdGpuTargetEnv_ << endl;
+    os << "Hipcc Record: "                   << var.hipccRecordEnv_ << endl;
+    os << "Hipcc Plan Only: "                << var.hipccPlanOnlyEnv_ << endl;
+    os << "Hipcc Cache Dir: "                << var.hipccCacheDirEnv_ << endl;
+    os << "Hipcc Cache Max Size: "           <<
+           var.hipccCacheMaxSizeEnv_ << endl;
+    os << "Hipcc Single Flight Dir: "        <<
+           var.hipccSingleFlightDirEnv_ << endl;
+    os << "Hipcc Remote Cache: "             << var.hipccRemoteCacheEnv_ << endl;
+    os << "Hipcc Remote Cache Timeout: "     <<
+           var.hipccRemoteCacheTimeoutEnv_ << endl;
+    os << "Hipcc Base Dir: "                 << var.hipccBaseDirEnv_ << endl;
+    os << "Hipcc Prefetch Dir: "             << var.hipccPrefetchDirEnv_ << endl;
+    os << "Hipcc Direct Cc1: "               << var.hipccDirectCc1Env_ << endl;
+    os << "Hipcc Jobs: "                     << var.hipccJobsEnv_ << endl;
+    os << "Hipcc Split Compile: "            << var.hipccSplitCompileEnv_
+       << endl;
+    os << "Hipcc Device Reuse: "             << var.hipccDeviceReuseEnv_
+       << endl;
+    os << "Hipcc Pch Dir: "                  << var.hipccPchDirEnv_ << endl;
+    os << "Hipcc Scan Dir: "                 << var.hipccScanDirEnv_ << endl;
+    os << "Hipcc Shared Preprocess: "        << var.hipccSharedPreprocessEnv_
+       << endl;
+    os << "Hipcc Spirv Aot Devices: "        << var.hipccSpirvAotDevicesEnv_
+       << endl;
+    os << "Hipcc Spirv Aot Tool: "           << var.hipccSpirvAotToolEnv_
+       << endl;
+    os << "Hipcc Spirv Opt: "                << var.hipccSpirvOptEnv_ << endl;
+    os << "Hipcc Spirv Opt Dir: "            << var.hipccSpirvOptDirEnv_
+       << endl;
+    os << "Hipcc Parallel Link: "            << var.hipccParallelLinkEnv_
+       << endl;
+    os << "Hipcc Link Partitions: "          << var.hipccLinkPartitionsEnv_
+       << endl;
+    os << "Hipcc Rdc Cache Dir: "            << var.hipccRdcCacheDirEnv_
+       << endl;
+    os << "Hipcc Fast Linker: "              << var.hipccFastLinkerEnv_
+       << endl;
     return os;
   }
 };
 
+// driver options given as --hipcc-* arguments. They are taken out of the
+// user arguments before the platform constructs its command.
+struct HipccOptions {
+  bool fingerprint = false;        // --hipcc-fingerprint
+  bool skipUpToDate = false;       // --hipcc-skip-up-to-date
+  int unity = 0;                   // --hipcc-unity[=N], sources per TU
+  vector<string> platforms;        // --hipcc-platforms=<platform>,...
+  // commands of the other platforms of --hipcc-platforms, whose device
+  // code is compiled along with this platform's
+  vector<string> deviceCommands;
+  bool commandOnly = false;        // construct the command, do not run it
+  string pgo;                      // --hipcc-pgo=generate|use:<dir>
+  string pgoDir;
+};
+
 enum HipBinCommand {
   unknown = -1,
   path,
@@ -205,6 +368,7 @@ enum HipBinCommand {
   check,
   newline,
   help,
+  json,
 };
 
 
@@ -218,7 +382,7 @@ class HipBinBase {
   virtual void printFull() = 0;
   virtual bool detectPlatform() = 0;
   virtual const string& getCompilerPath() const = 0;
-  virtual void printCompilerInfo() const = 0;
+  virtual void printCompilerInfo() = 0;
   virtual string getCompilerVersion() = 0;
   virtual string getCompilerIncludePath() = 0;
   virtual const PlatformInfo& getPlatformInfo() const = 0;
@@ -235,10 +399,41 @@ class HipBinBase {
   virtual const string& getHipCFlags() const = 0;
   virtual const string& getHipLdFlags() const = 0;
   virtual void executeHipCCCmd(vector<string> argv) = 0;
+  // the offload targets hipcc compiles for when none is given
+  virtual vector<string> getOffloadArchs() { return {}; }
   // Common functions used by all platforms
+  int runHipCCCmd(const string& command, const vector<string>& args);
+  const string& getCommand() const;
+  string getOutputSettings() const;
+  bool isDeviceFree(const string& command, const HipCCJob& job) const;
+  string fingerprint(const string& CMD, const HipCCJob& job,
+                     bool printInputs) const;
+  string normalizeIncludePaths(const string& flags) const;
+  string commandStamp(const string& CMD) const;
+  bool isUpToDate(const string& stamp, const HipCCJob& job) const;
+  string prefetchListPath(const HipCCJob& job) const;
+  string getPrefixMapFlags(const vector<string>& installRoots) const;
+  int runSingleCompile(const string& CMD, const HipCCJob& job);
+  int compileCaptured(const string& CMD, const HipCCJob& job,
+                      HipCCResult& result, vector<string>& includes);
+  int runCompile(const string& cmdline, const HipCCJob& job,
+                 const string& depFile, const string& errFile, string& out);
+  bool runUnityBuild(const string& CMD, const HipCCJob& job, int& exitCode);
+  int runSplitCompile(const string& cmdline, const HipCCJob& job,
+                      const string& depFile, const string& redirect,
+                      const HipccPchMap& pchs, string& out);
+  bool runParallelLink(const string& cmdline, const HipCCJob& job,
+                       const string& redirect, string& out, int& exitCode);
+  int getVerbose() const;
   void getSystemInfo() const;
   void printEnvironmentVariables() const;
+  void printOsRelease() const;
+  void printJson(const vector<string>& platforms);
+  void startProbes(const vector<string>& cmds);
+  SystemCmdOut runProbe(const string& cmd) const;
   const EnvVariables& getEnvVariables() const;
+  const HipccOptions& getHipccOptions() const;
+  void setHipccOptions(const HipccOptions& options);
   const OsType& getOSInfo() const;
   const string& getHipPath() const;
   const string& getRoccmPath() const;
@@ -254,6 +449,10 @@ class HipBinBase {
 
  private:
   EnvVariables envVariables_, variables_;
+  HipccOptions hipccOptions_;
+  string command_;
+  // the commands started by startProbes, by command line
+  map<string, std::shared_future<SystemCmdOut>> probes_;
   OsType osInfo_;
   string hipVersion_;
   void readOSInfo();
@@ -324,6 +523,60 @@ void HipBinBase::readEnvVariables() {
     envVariables_.hipClangHccCompactModeEnv_ = hipClangHccCompactMode;
   if (const char* hipCompileCxxAsHip = std::getenv(HIP_COMPILE_CXX_AS_HIP))
     envVariables_.hipCompileCxxAsHipEnv_ = hipCompileCxxAsHip;
+  if (const char* hipccRecord = std::getenv(HIPCC_RECORD))
+    envVariables_.hipccRecordEnv_ = hipccRecord;
+  if (const char* hipccPlanOnly = std::getenv(HIPCC_PLAN_ONLY))
+    envVariables_.hipccPlanOnlyEnv_ = hipccPlanOnly;
+  if (const char* hipccCacheDir = std::getenv(HIPCC_CACHE_DIR))
+    envVariables_.hipccCacheDirEnv_ = hipccCacheDir;
+  if (const char* hipccCacheMaxSize = std::getenv(HIPCC_CACHE_MAXSIZE))
+    envVariables_.hipccCacheMaxSizeEnv_ = hipccCacheMaxSize;
+  if (const char* hipccSingleFlightDir = std::getenv(HIPCC_SINGLE_FLIGHT_DIR))
+    envVariables_.hipccSingleFlightDirEnv_ = hipccSingleFlightDir;
+  if (const char* hipccRemoteCache = std::getenv(HIPCC_REMOTE_CACHE))
+    envVariables_.hipccRemoteCacheEnv_ = hipccRemoteCache;
+  if (const char* hipccRemoteCacheTimeout =
+      std::getenv(HIPCC_REMOTE_CACHE_TIMEOUT))
+    envVariables_.hipccRemoteCacheTimeoutEnv_ = hipccRemoteCacheTimeout;
+  if (const char* hipccPrefetchDir = std::getenv(HIPCC_PREFETCH_DIR))
+    envVariables_.hipccPrefetchDirEnv_ = hipccPrefetchDir;
+  if (const char* hipccDirectCc1 = std::getenv(HIPCC_DIRECT_CC1))
+    envVariables_.hipccDirectCc1Env_ = hipccDirectCc1;
+  if (const char* hipccJobs = std::getenv(HIPCC_JOBS))
+    envVariables_.hipccJobsEnv_ = hipccJobs;
+  if (const char* hipccSplitCompile = std::getenv(HIPCC_SPLIT_COMPILE))
+    envVariables_.hipccSplitCompileEnv_ = hipccSplitCompile;
+  if (const char* hipccDeviceReuse = std::getenv(HIPCC_DEVICE_REUSE))
+    envVariables_.hipccDeviceReuseEnv_ = hipccDeviceReuse;
+  if (const char* hipccPchDir = std::getenv(HIPCC_PCH_DIR))
+    envVariables_.hipccPchDirEnv_ = hipccPchDir;
+  if (const char* hipccScanDir = std::getenv(HIPCC_SCAN_DIR))
+    envVariables_.hipccScanDirEnv_ = hipccScanDir;
+  if (const char* hipccSharedPreprocess = std::getenv(HIPCC_SHARED_PREPROCESS))
+    envVariables_.hipccSharedPreprocessEnv_ = hipccSharedPreprocess;
+  if (const char* hipccSpirvAotDevices = std::getenv(HIPCC_SPIRV_AOT_DEVICES))
+    envVariables_.hipccSpirvAotDevicesEnv_ = hipccSpirvAotDevices;
+  if (const char* hipccSpirvAotTool = std::getenv(HIPCC_SPIRV_AOT_TOOL))
+    envVariables_.hipccSpirvAotToolEnv_ = hipccSpirvAotTool;
+  if (const char* hipccSpirvOpt = std::getenv(HIPCC_SPIRV_OPT))
+    envVariables_.hipccSpirvOptEnv_ = hipccSpirvOpt;
+  if (const char* hipccSpirvOptDir = std::getenv(HIPCC_SPIRV_OPT_DIR))
+    envVariables_.hipccSpirvOptDirEnv_ = hipccSpirvOptDir;
+  if (const char* hipccParallelLink = std::getenv(HIPCC_PARALLEL_LINK))
+    envVariables_.hipccParallelLinkEnv_ = hipccParallelLink;
+  if (const char* hipccLinkPartitions = std::getenv(HIPCC_LINK_PARTITIONS))
+    envVariables_.hipccLinkPartitionsEnv_ = hipccLinkPartitions;
+  if (const char* hipccRdcCacheDir = std::getenv(HIPCC_RDC_CACHE_DIR))
+    envVariables_.hipccRdcCacheDirEnv_ = hipccRdcCacheDir;
+  if (const char* hipccFastLinker = std::getenv(HIPCC_FAST_LINKER))
+    envVariables_.hipccFastLinkerEnv_ = hipccFastLinker;
+  if (const char* hipccBaseDir = std::getenv(HIPCC_BASE_DIR)) {
+    if (*hipccBaseDir != '\0') {
+      std::error_code ec;
+      envVariables_.hipccBaseDirEnv_ = hipBinUtilPtr_->normalizePath(
+                                       fs::absolute(hipccBaseDir, ec).string());
+    }
+  }
 }
 
 // constructs the HIP path
@@ -391,10 +644,115 @@ void HipBinBase::getSystemInfo() const {
   } else {
     assert(os == lnx);
     cout << endl << "== Linux Kernel" << endl;
-    cout << "Hostname      : " << std::flush;
-    system("hostname");
-    system("uname -a");
+    char hostname[256] = {};
+    gethostname(hostname, sizeof(hostname) - 1);
+    cout << "Hostname      : " << hostname << endl;
+    struct utsname name;
+    // uname -a also prints the operating system, GNU/Linux
+    if (uname(&name) == 0)
+      cout << name.sysname << " " << name.nodename << " " << name.release
+           << " " << name.version << " " << name.machine << " GNU/Linux"
+           << endl;
+  }
+}
+
+// prints the distribution like lsb_release -a, from /etc/os-release
+void HipBinBase::printOsRelease() const {
+  string text;
+  if (!hipBinUtilPtr_->readFile("/etc/os-release", text) &&
+      !hipBinUtilPtr_->readFile("/usr/lib/os-release", text)) {
+    if (fs::exists("/usr/bin/lsb_release"))
+      system("/usr/bin/lsb_release -a");
+    return;
+  }
+  map<string, string> release;
+  for (auto& line : hipBinUtilPtr_->splitStr(text, '\n')) {
+    size_t eq = line.find('=');
+    if (eq == string::npos)
+      continue;
+    string value = line.substr(eq + 1);
+    if (value.size() >= 2 && (value[0] == '"' || value[0] == '\''))
+      value = value.substr(1, value.size() - 2);
+    release[line.substr(0, eq)] = value;
   }
+  string id = release["ID"];
+  if (!id.empty())
+    id[0] = static_cast<char>(toupper(static_cast<unsigned char>(id[0])));
+  cout << "Distributor ID:\t" << id << endl;
+  cout << "Description:\t" << release["PRETTY_NAME"] << endl;
+  cout << "Release:\t" << release["VERSION_ID"] << endl;
+  cout << "Codename:\t" << release["VERSION_CODENAME"] << endl;
+}
+
+// prints the values of all hipconfig options, the flags hipcc adds, the
+// offload targets and the detected platforms as one JSON object. The flags
+// are taken from hipcc --cxxflags and --ldflags run in-process.
+void HipBinBase::printJson(const vector<string>& platforms) {
+  auto trimFlags = [&](const string& flags) {
+    string trimmed = hipBinUtilPtr_->trim(flags);
+    return trimmed.erase(0, trimmed.find_first_not_of(" \t"));
+  };
+  auto hipccOutput = [&](const string& option) {
+    std::ostringstream out;
+    std::streambuf* coutBuf = cout.rdbuf(out.rdbuf());
+    executeHipCCCmd({"hipcc", option});
+    cout.rdbuf(coutBuf);
+    return trimFlags(out.str());
+  };
+  auto jsonList = [&](const vector<string>& values) {
+    string list;
+    for (auto& value : values)
+      list += (list.empty() ? "" : ", ") + hipBinUtilPtr_->quoteJson(value);
+    return "[" + list + "]";
+  };
+  const PlatformInfo& platformInfo = getPlatformInfo();
+  string cxxFlags = hipccOutput("--cxxflags");
+  string ldFlags = hipccOutput("--ldflags");
+  initializeHipCFlags();
+  vector<std::pair<string, string>> values = {
+    {"version", getHipVersion()},
+    {"path", getHipPath()},
+    {"rocmpath", getRoccmPath()},
+    {"cpp_config", getCppConfig()},
+    {"compiler", CompilerTypeStr(platformInfo.compiler)},
+    {"platform", PlatformTypeStr(platformInfo.platform)},
+    {"runtime", RuntimeTypeStr(platformInfo.runtime)},
+    {"hipclangpath", getCompilerPath()},
+    {"cxxflags", cxxFlags},
+    {"cflags", trimFlags(getHipCFlags())},
+    {"ldflags", ldFlags},
+    {"device_lib_path", getDeviceLibPath()} };
+  cout << "{" << endl;
+  for (auto& value : values)
+    cout << "  " << hipBinUtilPtr_->quoteJson(value.first) << ": "
+         << hipBinUtilPtr_->quoteJson(value.second) << "," << endl;
+  cout << "  \"offload_archs\": " << jsonList(getOffloadArchs()) << ","
+       << endl;
+  cout << "  \"platforms\": " << jsonList(platforms) << endl;
+  cout << "}" << endl;
+}
+
+// starts the commands in the background; runProbe then returns their
+// results instead of running them again. Used by hipconfig, whose tool
+// queries are independent of each other.
+void HipBinBase::startProbes(const vector<string>& cmds) {
+  for (auto& cmd : cmds) {
+    if (probes_.count(cmd))
+      continue;
+    HipBinUtil* util = hipBinUtilPtr_;
+    probes_[cmd] = std::async(std::launch::async, [util, cmd]() {
+      return util->exec(cmd.c_str());
+    }).share();
+  }
+}
+
+// the output and exit code of the command, started by startProbes or run
+// now
+SystemCmdOut HipBinBase::runProbe(const string& cmd) const {
+  auto probe = probes_.find(cmd);
+  if (probe != probes_.end())
+    return probe->second.get();
+  return hipBinUtilPtr_->exec(cmd.c_str());
 }
 
 // prints the envirnoment variables
@@ -405,14 +763,60 @@ void HipBinBase::printEnvironmentVariables() const {
     system("set | findstr"
     " /B /C:\"HIP\" /C:\"HSA\" /C:\"CUDA\" /C:\"LD_LIBRARY_PATH\"");
   } else {
-    string cmd = "echo PATH =";
-    cmd += envVariables_.path_;
-    system(cmd.c_str());
-    system("env | egrep '^HIP|^HSA|^CUDA|^LD_LIBRARY_PATH'");
+    cout << "PATH =" << envVariables_.path_ << endl;
+    static const vector<string> prefixes = { "HIP", "HSA", "CUDA",
+                                             "LD_LIBRARY_PATH" };
+    for (char** env = environ; *env; env++) {
+      string var = *env;
+      for (auto& prefix : prefixes) {
+        if (var.compare(0, prefix.size(), prefix) == 0) {
+          cout << var << endl;
+          break;
+        }
+      }
+    }
   }
 }
 
 // returns envirnoment variables
+const HipccOptions& HipBinBase::getHipccOptions() const {
+  return hipccOptions_;
+}
+
+void HipBinBase::setHipccOptions(const HipccOptions& options) {
+  hipccOptions_ = options;
+}
+
+// the command constructed with HipccOptions::commandOnly
+const string& HipBinBase::getCommand() const {
+  return command_;
+}
+
+// the settings which change the output of a compile without being part of
+// its command: the optimization and native compile of SPIR-V, and the
+// contents of the --hipcc-pgo profile
+string HipBinBase::getOutputSettings() const {
+  const EnvVariables& var = getEnvVariables();
+  const HipccOptions& options = getHipccOptions();
+  string settings;
+  if (!options.pgo.empty())
+    settings += " " + hipBinUtilPtr_->quoteArg("hipcc-pgo=" +
+                HipBinPgo(options.pgo, options.pgoDir,
+                          hipBinUtilPtr_).profileIdentity());
+  if (getPlatformInfo().platform != intel && options.deviceCommands.empty())
+    return settings;
+  if (!var.hipccSpirvAotToolEnv_.empty() &&
+      !var.hipccSpirvAotDevicesEnv_.empty())
+    settings += " " + hipBinUtilPtr_->quoteArg(HIPCC_SPIRV_AOT_TOOL "=" +
+                                               var.hipccSpirvAotToolEnv_) +
+                " " + hipBinUtilPtr_->quoteArg(HIPCC_SPIRV_AOT_DEVICES "=" +
+                                               var.hipccSpirvAotDevicesEnv_);
+  if (!var.hipccSpirvOptEnv_.empty())
+    settings += " " + hipBinUtilPtr_->quoteArg(HIPCC_SPIRV_OPT "=" +
+                                               var.hipccSpirvOptEnv_);
+  return settings;
+}
+
 const EnvVariables& HipBinBase::getEnvVariables() const {
   return envVariables_;
 }
@@ -455,6 +859,9 @@ void HipBinBase::printUsage() const {
   cout << "  --version, -v      : print hip version\n";
   cout << "  --check            : check configuration\n";
   cout << "  --newline, -n      : print newline\n";
+  cout << "  --json             : print all of the above, the flags hipcc"
+  " adds, the offload\n                       targets and the detected"
+  " platforms as JSON\n";
   cout << "  --help, -h         : print help message\n";
 }
 
@@ -462,30 +869,617 @@ void HipBinBase::printUsage() const {
 
 // compiler canRun or not
 bool HipBinBase::canRunCompiler(string exeName, string& cmdOut) {
-  string compilerName = exeName;
-  string temp_dir = hipBinUtilPtr_->getTempDir();
-  fs::path templateFs = temp_dir;
-  templateFs /= "canRunXXXXXX";
-  string tmpFileName = hipBinUtilPtr_->mktempFile(templateFs.string());
-  compilerName += " --version > " + tmpFileName + " 2>&1";
-  bool executable = false;
-  if (system(const_cast<char*>(compilerName.c_str()))) {
-    executable = false;
+  // the compiler does not change while hipcc runs, so it is asked once
+  string probe = exeName + " --version 2>&1";
+  startProbes({probe});
+  SystemCmdOut sysOut = runProbe(probe);
+  if (sysOut.exitCode != 0)
+    return false;
+  for (auto& line : hipBinUtilPtr_->splitStr(sysOut.out, '\n'))
+    cmdOut += line;
+  return true;
+}
+
+// returns the HIPCC_VERBOSE bits
+// 0x1=commands, 0x2=paths, 0x4=hipcc args, 0x8=cache and driver decisions
+int HipBinBase::getVerbose() const {
+  const EnvVariables& var = getEnvVariables();
+  return var.verboseEnv_.empty() ? 0 : stoi(var.verboseEnv_);
+}
+
+// runs the command constructed by the platform and returns its exit code.
+// args are the user arguments without argv[0].
+// With HIPCC_PLAN_ONLY=1 the command is only printed, which is what
+// --hipcc-replay uses to time the driver without the compiler.
+// With HipccOptions::commandOnly it is kept for getCommand instead.
+int HipBinBase::runHipCCCmd(const string& command,
+                            const vector<string>& args) {
+  const EnvVariables& var = getEnvVariables();
+  const HipccOptions& options = getHipccOptions();
+  if (options.commandOnly) {
+    command_ = command;
+    return 0;
+  }
+  HipCCJob job;
+  job.parse(args);
+  job.baseDir = var.hipccBaseDirEnv_;
+  string CMD = command;
+  if (!options.deviceCommands.empty() && (!job.isSingleCompile() ||
+      getOSInfo() == windows || getPlatformInfo().compiler != clang)) {
+    cout << "hipcc: --hipcc-platforms needs a single source compile (-c)"
+         << endl;
+    return -1;
+  }
+  // host profile guided optimization
+  if (!options.pgo.empty() && getPlatformInfo().compiler == clang) {
+    HipBinPgo pgo(options.pgo, options.pgoDir, hipBinUtilPtr_);
+    CMD += pgo.flags(CMD, job, getCompilerPath(),
+                     var.hipccPlanOnlyEnv_ != "1" && !options.fingerprint);
+  } else if (!options.pgo.empty()) {
+    std::cerr << "hipcc: warning: --hipcc-pgo needs clang, ignored" << endl;
+  }
+  if (getPlatformInfo().compiler == clang && getOSInfo() != windows) {
+    HipBinFastLinker linker(var.hipccFastLinkerEnv_, hipBinUtilPtr_);
+    CMD += linker.flags(CMD, job, getCompilerPath(),
+                        HipBinTaskRunner::defaultJobs(var.hipccJobsEnv_));
+    if (!linker.linker().empty() && (getVerbose() & 0x8))
+      cout << "hipcc: linking with " << linker.linker() << endl;
+  }
+  if (options.deviceCommands.empty() && isDeviceFree(command, job)) {
+    CMD += " --cuda-host-only";
+    if (getVerbose() & 0x8)
+      cout << "hipcc: " << job.sources.at(0)
+           << " has no device code, compiling for the host only" << endl;
+  }
+  if (var.hipccPlanOnlyEnv_ == "1") {
+    cout << "hipcc-cmd: " << CMD << endl;
+    return 0;
+  }
+  // the commands of all platforms, for the fingerprint and the stamp
+  string allCmds = CMD + getOutputSettings();
+  for (auto& deviceCmd : options.deviceCommands)
+    allCmds += " " + deviceCmd;
+  if (getHipccOptions().fingerprint) {
+    cout << fingerprint(allCmds, job, getVerbose() & 0x8) << endl;
+    return 0;
+  }
+  // the stamp next to the output records the command which produced it
+  bool checkUpToDate = getHipccOptions().skipUpToDate && job.compileOnly &&
+                       !job.preprocessOnly && job.writesDeps &&
+                       !job.output.empty() && job.output != "-";
+  string stamp, stampFile = job.output + ".hipcc-stamp";
+  if (checkUpToDate) {
+    stamp = commandStamp(allCmds);
+    if (isUpToDate(stamp, job)) {
+      if (getVerbose() & 0x8)
+        cout << "hipcc: " << job.output << " is up to date" << endl;
+      return 0;
+    }
+  }
+  int unityExitCode;
+  if (getHipccOptions().unity > 0 && getOSInfo() != windows &&
+      runUnityBuild(CMD, job, unityExitCode))
+    return unityExitCode;
+  // headers read by the previous compile of the source
+  HipBinPrefetcher prefetcher;
+  string prefetchList = prefetchListPath(job);
+  if (!prefetchList.empty())
+    prefetcher.start(hipBinUtilPtr_->parseDepFile(
+                     job.writesDeps ? job.depFile : prefetchList));
+  int CMD_EXIT_CODE;
+  if ((!var.hipccCacheDirEnv_.empty() ||
+       !var.hipccRemoteCacheEnv_.empty() ||
+       !var.hipccSingleFlightDirEnv_.empty()) &&
+      getOSInfo() != windows && job.isSingleCompile() &&
+      options.deviceCommands.empty()) {
+    CMD_EXIT_CODE = runSingleCompile(CMD, job);
   } else {
-    string myline;
-    ifstream fp;
-    fp.open(tmpFileName);
-    if (fp.is_open()) {
-      while (std::getline(fp, myline)) {
-        cmdOut += myline;
+    string cmd = CMD, depFile = job.depFile, out;
+    if (!prefetchList.empty() && !job.writesDeps) {
+      cmd += " -MD -MF " + hipBinUtilPtr_->quoteArg(prefetchList);
+      depFile = prefetchList;
+    }
+    CMD_EXIT_CODE = runCompile(cmd, job, depFile, "", out);
+    cout << out << endl;
+    if (CMD_EXIT_CODE != 0) {
+      cout << "failed to execute:" << CMD << std::endl;
+    }
+  }
+  if (checkUpToDate && CMD_EXIT_CODE == 0)
+    hipBinUtilPtr_->writeFileAtomic(stampFile, stamp + "\n");
+  return CMD_EXIT_CODE;
+}
+
+// true for a single HIP compile whose source and headers have no device code
+// (HIPCC_SCAN_DIR). The headers are those of the dependency file of the last
+// compile, the user's or the prefetch list, without which the source counts
+// as device code.
+bool HipBinBase::isDeviceFree(const string& command,
+                              const HipCCJob& job) const {
+  const EnvVariables& var = getEnvVariables();
+  if (var.hipccScanDirEnv_.empty() || !job.isSingleCompile() ||
+      getPlatformInfo().compiler != clang)
+    return false;
+  vector<string> args = hipBinUtilPtr_->splitCmdLine(command);
+  bool isHip = false;
+  for (size_t i = 0; i + 1 < args.size(); i++) {
+    const string& arg = args[i];
+    if (arg == "--genco" || arg == "--cuda-host-only" ||
+        arg == "--cuda-device-only" || arg == "--offload-host-only" ||
+        arg == "--offload-device-only")
+      return false;
+    if (arg == "-x")
+      isHip = args[i + 1] == "hip";
+    if (args[i + 1] == job.sources.at(0))
+      break;
+  }
+  if (!isHip)
+    return false;
+  string depFile = job.writesDeps ? job.depFile : prefetchListPath(job);
+  std::error_code ec;
+  if (depFile.empty() || !fs::exists(depFile, ec))
+    return false;
+  vector<string> deps = hipBinUtilPtr_->parseDepFile(depFile);
+  HipBinDeviceScan scan(var.hipccScanDirEnv_, hipBinUtilPtr_);
+  return !deps.empty() && scan.isDeviceFree(job.sources.at(0), deps);
+}
+
+// compiles the HIP sources of the invocation in unity groups
+// (--hipcc-unity). False when there is nothing to group or the unity build
+// failed, the command is then run as it is.
+bool HipBinBase::runUnityBuild(const string& CMD, const HipCCJob& job,
+                               int& exitCode) {
+  HipBinUnity unity(getHipccOptions().unity, hipBinUtilPtr_);
+  if (!unity.plan(job))
+    return false;
+  string tmpDir = hipBinUtilPtr_->mkdtempDir(
+                  (fs::path(hipBinUtilPtr_->getTempDir()) /
+                   "hipccXXXXXX").string());
+  if (tmpDir.empty())
+    return false;
+  string errFile = (fs::path(tmpDir) / "stderr").string(), out, diagnostics;
+  if (unity.write(tmpDir)) {
+    string cmd = unity.rewrite(CMD);
+    // clang only warns when sources of a group define a macro differently
+    if (getPlatformInfo().compiler == clang)
+      cmd += " -Werror=macro-redefined";
+    if (getVerbose() & 0x1)
+      cout << "hipcc-unity: " << cmd << endl;
+    exitCode = runCompile(cmd, job, "", errFile, out);
+    hipBinUtilPtr_->readFile(errFile, diagnostics);
+  } else {
+    exitCode = -1;
+  }
+  std::error_code ec;
+  fs::remove_all(tmpDir, ec);
+  if (exitCode != 0) {
+    if (getVerbose() & 0x8)
+      cout << "hipcc: unity build failed, compiling the sources separately"
+           << endl;
+    return false;
+  }
+  std::cerr << diagnostics;
+  cout << out << endl;
+  return true;
+}
+
+// runs the command line of a compile. With HIPCC_DIRECT_CC1 the jobs of a
+// single source compile are run directly from the cached driver plan, at
+// most HIPCC_JOBS at a time, and with HIPCC_SPLIT_COMPILE=1 the host code
+// and the device code of each target are compiled as separate jobs, as they
+// are with the precompiled headers of HIPCC_PCH_DIR. The standard error goes
+// to errFile when it is not empty, the standard output is returned in out.
+int HipBinBase::runCompile(const string& cmdline, const HipCCJob& job,
+                           const string& depFile, const string& errFile,
+                           string& out) {
+  const EnvVariables& var = getEnvVariables();
+  string redirect = errFile.empty() ? "" :
+                    " 2>> " + hipBinUtilPtr_->quoteArg(errFile);
+  if (!var.hipccDirectCc1Env_.empty() && job.isSingleCompile() &&
+      getOSInfo() != windows && getHipccOptions().deviceCommands.empty()) {
+    HipccPlanNames names = { {"@SRC@", job.sources.at(0)},
+                             {"@OUT@", job.output}, {"@DEP@", depFile},
+                             {"@TGT@", job.depTarget} };
+    HipBinPlan plan(var.hipccDirectCc1Env_, hipBinUtilPtr_);
+    string tmpDir = hipBinUtilPtr_->mkdtempDir(
+                    (fs::path(hipBinUtilPtr_->getTempDir()) /
+                     "hipccXXXXXX").string());
+    if (!tmpDir.empty() &&
+        plan.load(cmdline, names, hipBinUtilPtr_->fileIdentity(getHipCC()))) {
+      vector<HipccTask> tasks = plan.bind(names, tmpDir, redirect);
+      if (getVerbose() & 0x1) {
+        for (auto& task : tasks)
+          cout << "hipcc-job: " << task.cmd << endl;
       }
+      HipBinTaskRunner runner(HipBinTaskRunner::defaultJobs(var.hipccJobsEnv_),
+                              hipBinUtilPtr_);
+      int exitCode = runner.run(tasks, out);
+      std::error_code ec;
+      fs::remove_all(tmpDir, ec);
+      return exitCode;
+    }
+    std::error_code ec;
+    if (!tmpDir.empty())
+      fs::remove_all(tmpDir, ec);
+  } else if (job.isSingleCompile() && getOSInfo() != windows &&
+             getPlatformInfo().compiler == clang) {
+    vector<string> args = hipBinUtilPtr_->splitCmdLine(cmdline);
+    HipccPchMap pchs;
+    if (!var.hipccPchDirEnv_.empty() &&
+        HipBinPch::usable(args, job, hipBinUtilPtr_)) {
+      HipBinTaskRunner runner(HipBinTaskRunner::defaultJobs(
+                              var.hipccJobsEnv_), hipBinUtilPtr_);
+      pchs = HipBinPch(var.hipccPchDirEnv_, hipBinUtilPtr_).get(
+             args, job, hipBinUtilPtr_->fileIdentity(getHipCC()), &runner);
+    }
+    // the stages which process the SPIR-V of a complete device module
+    bool spirvStages = ((!var.hipccSpirvAotToolEnv_.empty() &&
+                         !var.hipccSpirvAotDevicesEnv_.empty()) ||
+                        !var.hipccSpirvOptEnv_.empty()) &&
+                       getPlatformInfo().platform == intel &&
+                       !HipBinSplitCompile::isRdc(args);
+    if (!pchs.empty() || !getHipccOptions().deviceCommands.empty() ||
+        spirvStages || (var.hipccSplitCompileEnv_ == "1" &&
+                        HipBinSplitCompile::applies(args)))
+      return runSplitCompile(cmdline, job, depFile, redirect, pchs, out);
+  } else if ((var.hipccParallelLinkEnv_ == "1" ||
+              !var.hipccRdcCacheDirEnv_.empty()) && getOSInfo() != windows &&
+             getPlatformInfo().platform == amd &&
+             HipBinDeviceLink::applies(hipBinUtilPtr_->splitCmdLine(cmdline),
+                                       job)) {
+    int exitCode;
+    if (runParallelLink(cmdline, job, redirect, out, exitCode))
+      return exitCode;
+  }
+  string cmd = errFile.empty() ? cmdline :
+               cmdline + " 2> " + hipBinUtilPtr_->quoteArg(errFile);
+  SystemCmdOut sysOut = hipBinUtilPtr_->exec(cmd.c_str());
+  out = sysOut.out;
+  return sysOut.exitCode;
+}
+
+// runs the host compile and the device compile of each offload target
+// concurrently (HIPCC_SPLIT_COMPILE) and bundles them into the output. With
+// HIPCC_DEVICE_REUSE=1 the device objects are kept in <output>.hipcc-device
+// and reused for the targets whose object is up to date. Each compile
+// includes its precompiled header from pchs, if any. With
+// HIPCC_SHARED_PREPROCESS=1 the source is preprocessed once for all of them.
+// The device code of the other platforms of --hipcc-platforms is compiled
+// along with it, and SPIR-V is compiled ahead of time for the devices of
+// HIPCC_SPIRV_AOT_DEVICES with HIPCC_SPIRV_AOT_TOOL, after HIPCC_SPIRV_OPT
+// optimized it.
+int HipBinBase::runSplitCompile(const string& cmdline, const HipCCJob& job,
+                                const string& depFile, const string& redirect,
+                                const HipccPchMap& pchs, string& out) {
+  const EnvVariables& var = getEnvVariables();
+  string tmpDir = hipBinUtilPtr_->mkdtempDir(
+                  (fs::path(hipBinUtilPtr_->getTempDir()) /
+                   "hipccXXXXXX").string());
+  if (tmpDir.empty())
+    return -1;
+  string bundler = (fs::path(getCompilerPath()) /
+                    "clang-offload-bundler").string();
+  HipBinSplitCompile split(bundler, tmpDir, hipBinUtilPtr_);
+  if (var.hipccDeviceReuseEnv_ == "1")
+    split.setDeviceObjectDir(job.output + ".hipcc-device");
+  if (var.hipccSharedPreprocessEnv_ == "1")
+    split.sharePreprocessedSource();
+  split.setPrecompiledHeaders(pchs);
+  split.prepare(cmdline, job, depFile, redirect);
+  for (auto& deviceCmd : getHipccOptions().deviceCommands)
+    split.addDeviceCompile(deviceCmd, job);
+  if (!var.hipccSpirvAotToolEnv_.empty() &&
+      !var.hipccSpirvAotDevicesEnv_.empty())
+    split.setNativeCompile(var.hipccSpirvAotToolEnv_,
+        hipBinUtilPtr_->splitStr(var.hipccSpirvAotDevicesEnv_, ','));
+  if (!var.hipccSpirvOptEnv_.empty())
+    split.setSpirvOptimizer(var.hipccSpirvOptEnv_, var.hipccSpirvOptDirEnv_);
+  HipBinTaskRunner runner(HipBinTaskRunner::defaultJobs(
+                          var.hipccJobsEnv_), hipBinUtilPtr_);
+  int exitCode = split.run(&runner, job.output, getVerbose() & 0x1, out);
+  std::error_code ec;
+  fs::remove_all(tmpDir, ec);
+  return exitCode;
+}
+
+// runs the driver jobs of a -fgpu-rdc link directly, the device links of
+// the offload targets in parallel and, with HIPCC_PARALLEL_LINK and
+// HIPCC_LINK_PARTITIONS, each split into LTO partitions. With
+// HIPCC_RDC_CACHE_DIR the device code extracted from the inputs is cached.
+// False when the jobs can not be captured, and the link is to be run as
+// usual.
+bool HipBinBase::runParallelLink(const string& cmdline, const HipCCJob& job,
+                                 const string& redirect, string& out,
+                                 int& exitCode) {
+  const EnvVariables& var = getEnvVariables();
+  string tmpDir = hipBinUtilPtr_->mkdtempDir(
+                  (fs::path(hipBinUtilPtr_->getTempDir()) /
+                   "hipccXXXXXX").string());
+  if (tmpDir.empty())
+    return false;
+  int maxJobs = HipBinTaskRunner::defaultJobs(var.hipccJobsEnv_);
+  HipBinDeviceLink link(tmpDir, hipBinUtilPtr_);
+  link.setExtractCache(var.hipccRdcCacheDirEnv_);
+  int partitions = 1;
+  if (var.hipccParallelLinkEnv_ == "1" &&
+      var.hipccLinkPartitionsEnv_ == "auto")
+    partitions = 0;
+  else if (var.hipccParallelLinkEnv_ == "1")
+    partitions = std::max(1, std::atoi(var.hipccLinkPartitionsEnv_.c_str()));
+  bool prepared = link.prepare(cmdline, job,
+                               hipBinUtilPtr_->fileIdentity(getHipCC()),
+                               partitions, maxJobs, redirect);
+  if (prepared) {
+    if (getVerbose() & 0x1) {
+      for (auto& task : link.getTasks())
+        cout << "hipcc-job: " << task.cmd << endl;
+    }
+    HipBinTaskRunner runner(maxJobs, hipBinUtilPtr_);
+    exitCode = runner.run(link.getTasks(), out);
+    if (exitCode == 0)
+      link.storeExtracted();
+  } else if (getVerbose() & 0x8) {
+    cout << "hipcc: no device links found, linking as usual" << endl;
+  }
+  std::error_code ec;
+  fs::remove_all(tmpDir, ec);
+  return prepared;
+}
+
+// the dependency file listing the headers of the source for prefetching,
+// written by the compiles which do not write one for the user. Empty when
+// HIPCC_PREFETCH_DIR is not set or for invocations other than a single
+// compile.
+string HipBinBase::prefetchListPath(const HipCCJob& job) const {
+  const string& dir = getEnvVariables().hipccPrefetchDirEnv_;
+  if (dir.empty() || !job.isSingleCompile() || getOSInfo() == windows)
+    return "";
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  HipBinHash hash;
+  hash.update(fs::absolute(job.sources.at(0), ec).string());
+  return (fs::path(dir) / (hash.hexDigest() + ".d")).string();
+}
+
+// hash of the resolved command and of the environment clang reads
+string HipBinBase::commandStamp(const string& CMD) const {
+  HipBinHash hash;
+  hash.update(CMD);
+  for (auto& name : hipccClangEnv) {
+    const char* value = std::getenv(name.c_str());
+    hash.update(name + "=" + (value ? value : ""));
+  }
+  return hash.hexDigest();
+}
+
+// true when the output of the compile exists, was produced by the same
+// command and is not older than any file of its dependency file, the
+// compiler or hipcc itself. Only file times are looked at, like make does.
+bool HipBinBase::isUpToDate(const string& stamp, const HipCCJob& job) const {
+  string oldStamp;
+  if (!hipBinUtilPtr_->readFile(job.output + ".hipcc-stamp", oldStamp) ||
+      oldStamp != stamp + "\n")
+    return false;
+  std::error_code ec;
+  auto outputTime = fs::last_write_time(job.output, ec);
+  if (ec || !fs::exists(job.depFile, ec))
+    return false;
+  vector<string> deps = hipBinUtilPtr_->parseDepFile(job.depFile);
+  if (deps.empty())
+    return false;
+  deps.push_back(hipBinUtilPtr_->getSelfExe());
+  deps.push_back(getHipCC());
+  for (auto& dep : deps) {
+    auto depTime = fs::last_write_time(dep, ec);
+    if (ec || depTime > outputTime)
+      return false;
+  }
+  return true;
+}
+
+// rewrites the paths of the -I, -isystem and -include options in the flags
+// to their normal form, so "<clang>/include/.." and "<clang>/" are the same
+// include path in the command and in everything derived from it. Only done
+// when HIPCC_BASE_DIR asks for location independent outputs.
+string HipBinBase::normalizeIncludePaths(const string& flags) const {
+  if (getEnvVariables().hipccBaseDirEnv_.empty())
+    return flags;
+  regex pathOpt("(-isystem *|-include *|-I *)(\"([^\"]*)\"|([^\" ]+))");
+  string out;
+  auto last = flags.cbegin();
+  for (std::sregex_iterator it(flags.begin(), flags.end(), pathOpt), end;
+       it != end; ++it) {
+    const smatch& match = *it;
+    bool quoted = match[3].matched;
+    string path = hipBinUtilPtr_->normalizePath(quoted ? match[3] : match[4]);
+    out.append(last, match[0].first);
+    out += match[1].str() + (quoted ? "\"" + path + "\"" : path);
+    last = match[0].second;
+  }
+  out.append(last, flags.cend());
+  return out;
+}
+
+// -ffile-prefix-map options mapping HIPCC_BASE_DIR to "." and the install
+// roots to fixed names, so that __FILE__, debug info and the like do not
+// depend on where the workspace and HIP are. Empty unless HIPCC_BASE_DIR
+// is set.
+string HipBinBase::getPrefixMapFlags(const vector<string>& installRoots)
+                                     const {
+  const string& baseDir = getEnvVariables().hipccBaseDirEnv_;
+  if (baseDir.empty())
+    return "";
+  vector<std::pair<string, string>> maps = { {baseDir, "."} };
+  for (auto& root : installRoots) {
+    string path = hipBinUtilPtr_->normalizePath(root);
+    if (!root.empty() && path != "/")
+      maps.push_back({path, "/" + fs::path(path).filename().string()});
+  }
+  // clang applies the first matching prefix, so the longest come first
+  std::stable_sort(maps.begin(), maps.end(), [](
+      const std::pair<string, string>& a, const std::pair<string, string>& b) {
+    return a.first.size() > b.first.size();
+  });
+  string flags;
+  for (auto& map : maps)
+    flags += " -ffile-prefix-map=" +
+             hipBinUtilPtr_->quoteArg(map.first + "=" + map.second);
+  return flags;
+}
+
+// hash of what the invocation would do: the resolved command, the contents
+// of the compiler binary and of the input files named on the command line.
+// Headers are not known before compiling and are not part of it. Used by
+// external caches and schedulers through --hipcc-fingerprint.
+string HipBinBase::fingerprint(const string& CMD, const HipCCJob& job,
+                               bool printInputs) const {
+  string compiler = getHipCC();
+  std::error_code ec;
+  fs::path resolved = fs::canonical(compiler, ec);
+  if (!ec)
+    compiler = resolved.string();
+  string compilerHash = hipBinUtilPtr_->hashFile(compiler);
+  HipBinHash hash;
+  hash.update(string("hipcc-fingerprint-1"));
+  hash.update(job.inputKey(CMD, compilerHash, hipBinUtilPtr_));
+  if (printInputs) {
+    cout << "hipcc-fingerprint: command " << CMD << endl;
+    cout << "hipcc-fingerprint: compiler " << compilerHash << " "
+         << compiler << endl;
+    for (auto& source : job.sources)
+      cout << "hipcc-fingerprint: input " << hipBinUtilPtr_->hashFile(source)
+           << " " << source << endl;
+  }
+  for (auto& input : job.inputs) {
+    string inputHash = hipBinUtilPtr_->hashFile(input);
+    hash.update(input).update(inputHash);
+    if (printInputs)
+      cout << "hipcc-fingerprint: input " << inputHash << " " << input << endl;
+  }
+  return hash.hexDigest();
+}
+
+// runs a single source compile, reusing the result of an identical compile
+// from the HIPCC_CACHE_DIR cache or from a concurrent identical invocation
+// (HIPCC_SINGLE_FLIGHT_DIR) when possible.
+int HipBinBase::runSingleCompile(const string& CMD, const HipCCJob& job) {
+  const EnvVariables& var = getEnvVariables();
+  bool verbose = getVerbose() & 0x8;
+  string compilerId = hipBinUtilPtr_->fileIdentity(getHipCC());
+  string inputKey = job.inputKey(CMD + getOutputSettings(), compilerId,
+                                 hipBinUtilPtr_);
+  string manifestKey = HipBinCache::manifestKey(inputKey);
+  string resultKey;
+  HipCCResult result;
+
+  std::unique_ptr<HipBinCache> cache;
+  if (!var.hipccCacheDirEnv_.empty()) {
+    cache.reset(new HipBinCache(var.hipccCacheDirEnv_,
+                                var.hipccCacheMaxSizeEnv_, hipBinUtilPtr_));
+    if (cache->lookup(manifestKey, job, resultKey) &&
+        cache->readResult(resultKey, result) &&
+        HipBinCache::restore(job, result, hipBinUtilPtr_)) {
+      if (verbose)
+        cout << "hipcc-cache: hit " << resultKey << endl;
+      cout << result.stdoutText << endl;
+      std::cerr << result.stderrText;
+      return 0;
     }
-    fp.close();
-    executable = true;
   }
 
-  fs::remove(tmpFileName);
-  return executable;
+  std::unique_ptr<HipBinRemoteCache> remote;
+  if (!var.hipccRemoteCacheEnv_.empty()) {
+    remote.reset(new HipBinRemoteCache(var.hipccRemoteCacheEnv_,
+                                       var.hipccRemoteCacheTimeoutEnv_,
+                                       hipBinUtilPtr_));
+    if (remote->lookup(manifestKey, job, result) &&
+        HipBinCache::restore(job, result, hipBinUtilPtr_)) {
+      if (verbose)
+        cout << "hipcc-remote-cache: hit " << manifestKey << endl;
+      cout << result.stdoutText << endl;
+      std::cerr << result.stderrText;
+      return 0;
+    }
+    if (verbose && remote->failed())
+      cout << "hipcc-remote-cache: unavailable, compiling locally" << endl;
+  }
+
+  std::unique_ptr<HipBinSingleFlight> flight;
+  if (!var.hipccSingleFlightDirEnv_.empty()) {
+    flight.reset(new HipBinSingleFlight(var.hipccSingleFlightDirEnv_,
+                                        inputKey, hipBinUtilPtr_));
+    if (flight->join(result) &&
+        HipBinCache::restore(job, result, hipBinUtilPtr_)) {
+      if (verbose)
+        cout << "hipcc-single-flight: reused " << inputKey << endl;
+      cout << result.stdoutText << endl;
+      std::cerr << result.stderrText;
+      return 0;
+    }
+  }
+
+  vector<string> includes;
+  auto compileStart = fs::file_time_type::clock::now();
+  int exitCode = compileCaptured(CMD, job, result, includes);
+  if (exitCode != 0)
+    return exitCode;
+  if (flight)
+    flight->publish(result);
+  if (cache || remote) {
+    string entry = HipBinCache::manifestEntry(manifestKey, includes, job,
+                                              compileStart, resultKey,
+                                              hipBinUtilPtr_);
+    if (entry.empty()) {
+      if (verbose)
+        cout << "hipcc-cache: a header changed during the compile, "
+             << "not stored" << endl;
+      return 0;
+    }
+    if (cache)
+      cache->store(manifestKey, resultKey, entry, result);
+    if (remote)
+      remote->store(manifestKey, resultKey, entry, result);
+    if (verbose && (cache || !remote->failed()))
+      cout << "hipcc-cache: miss, stored " << resultKey << endl;
+  }
+  return 0;
+}
+
+// runs the compile with stdout and stderr captured into result, along with
+// the object and the headers read, which come from a dependency file the
+// compile writes if the user did not ask for one
+int HipBinBase::compileCaptured(const string& CMD, const HipCCJob& job,
+                                HipCCResult& result,
+                                vector<string>& includes) {
+  string tmpDir = hipBinUtilPtr_->getTempDir();
+  string prefetchList = prefetchListPath(job);
+  bool tmpDepFile = !job.writesDeps && prefetchList.empty();
+  string depFile = job.writesDeps ? job.depFile : !tmpDepFile ? prefetchList :
+                   hipBinUtilPtr_->mktempFile(
+                   (fs::path(tmpDir) / "hipccdepXXXXXX").string());
+  string errFile = hipBinUtilPtr_->mktempFile(
+                   (fs::path(tmpDir) / "hipccerrXXXXXX").string());
+  string cmd = CMD;
+  if (!job.writesDeps)
+    cmd += " -MD -MF " + hipBinUtilPtr_->quoteArg(depFile);
+  int exitCode = runCompile(cmd, job, depFile, errFile, result.stdoutText);
+  hipBinUtilPtr_->readFile(errFile, result.stderrText);
+  cout << result.stdoutText << endl;
+  std::cerr << result.stderrText;
+  if (exitCode == 0 && !hipBinUtilPtr_->readFile(job.output, result.object))
+    exitCode = -1;
+  if (exitCode == 0) {
+    if (job.writesDeps && hipBinUtilPtr_->readFile(depFile, result.depFile))
+      result.depFile = job.portablePath(result.depFile);
+    includes = hipBinUtilPtr_->parseDepFile(depFile);
+  } else {
+    cout << "failed to execute:" << CMD << std::endl;
+  }
+  std::error_code ec;
+  if (tmpDepFile)
+    fs::remove(depFile, ec);
+  fs::remove(errFile, ec);
+  return exitCode;
 }
 
 HipBinCommand HipBinBase::gethipconfigCmd(string argument) {
@@ -524,6 +1518,9 @@ HipBinCommand HipBinBase::gethipconfigCmd(string argument) {
   vector<string> newlineStrs = { "--n", "-n", "--newline", "-newline" };
   if (hipBinUtilPtr_->checkCmd(newlineStrs, argument))
     return newline;
+  vector<string> jsonStrs = { "--json", "-json" };
+  if (hipBinUtilPtr_->checkCmd(jsonStrs, argument))
+    return json;
   vector<string> helpStrs = { "-h", "--help", "-help", "--h" };
   if (hipBinUtilPtr_->checkCmd(helpStrs, argument))
     return help;
@@ -0,0 +1,474 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_CACHE_H_
+#define SRC_HIPBIN_CACHE_H_
+
+#include "hipBin_util.h"
+#include "hipBin_job.h"
+#include "hipBin_http.h"
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <string>
+
+/**
+ * Local compilation result cache (HIPCC_CACHE_DIR).
+ *
+ * Lookups work in "direct mode" like ccache: the manifest key covers what
+ * is known before compiling (final command, compiler identity, source
+ * contents, working directory). The manifest stored under it lists, for each
+ * earlier compile, the headers that compile read together with their hashes.
+ * When all headers of an entry are unchanged its result key is used,
+ * so a hit needs no preprocessor run. A compile which read a header
+ * modified after it started is not stored, as the object may have been
+ * built from the header's earlier contents.
+ *
+ * Layout: <dir>/<k>/<key>.manifest and <dir>/<k>/<key>.result where <k> is
+ * the first hex digit of the key. Each of the 16 shards keeps its byte total
+ * in <dir>/<k>/stats and is trimmed on its own, least recently used first,
+ * once it exceeds 1/16 of HIPCC_CACHE_MAXSIZE.
+ */
+
+# define HIPCC_CACHE_VERSION        "hipcc-cache-2"
+# define HIPCC_CACHE_DEFAULT_SIZE   (5ULL << 30)
+# define HIPCC_CACHE_SHARDS         16
+# define HIPCC_CACHE_MANIFEST_MAX   16
+
+// Everything a compile produced which is replayed on a hit
+struct HipCCResult {
+  string object;
+  string stdoutText;
+  string stderrText;
+  string depFile;
+};
+
+class HipBinCache {
+ public:
+  HipBinCache(const string& cacheDir, const string& maxSize,
+              HipBinUtil* hipBinUtilPtr);
+  static string manifestKey(const string& inputKey);
+  bool lookup(const string& manifestKey, const HipCCJob& job,
+              string& resultKey) const;
+  bool readResult(const string& resultKey, HipCCResult& result) const;
+  static bool restore(const HipCCJob& job, const HipCCResult& result,
+                      HipBinUtil* hipBinUtilPtr);
+  void store(const string& manifestKey, const string& resultKey,
+             const string& entry, const HipCCResult& result);
+  static bool matchManifest(const string& manifest, const HipCCJob& job,
+                            string& resultKey, HipBinUtil* hipBinUtilPtr);
+  static string manifestEntry(const string& manifestKey,
+                              const vector<string>& includes,
+                              const HipCCJob& job,
+                              fs::file_time_type compileStart,
+                              string& resultKey, HipBinUtil* hipBinUtilPtr);
+  static string addToManifest(const string& manifest, const string& resultKey,
+                              const string& entry);
+  static string packResult(const HipCCResult& result);
+  static bool unpackResult(const string& packed, HipCCResult& result);
+  static uint64_t parseSize(const string& size);
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  fs::path cacheDir_;
+  uint64_t maxSize_;
+  fs::path entryPath(const string& key, const string& ext) const;
+  void touch(const fs::path& path) const;
+  void addToShard(const string& key, int64_t bytes);
+  void cleanShard(const fs::path& shardDir, uint64_t limit);
+};
+
+HipBinCache::HipBinCache(const string& cacheDir, const string& maxSize,
+                         HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr), cacheDir_(cacheDir),
+    maxSize_(parseSize(maxSize)) {}
+
+// parses sizes like 500M or 5G, returns the default for empty or bad input
+uint64_t HipBinCache::parseSize(const string& size) {
+  char* end = nullptr;
+  double value = std::strtod(size.c_str(), &end);
+  if (size.empty() || end == size.c_str() || value <= 0)
+    return HIPCC_CACHE_DEFAULT_SIZE;
+  switch (toupper(*end)) {
+  case 'K': value *= 1ULL << 10; break;
+  case 'M': value *= 1ULL << 20; break;
+  case 'G': value *= 1ULL << 30; break;
+  case 'T': value *= 1ULL << 40; break;
+  default: break;
+  }
+  return static_cast<uint64_t>(value);
+}
+
+fs::path HipBinCache::entryPath(const string& key, const string& ext) const {
+  return cacheDir_ / key.substr(0, 1) / (key + ext);
+}
+
+// the manifest key is the job's input key (see HipCCJob::inputKey) tied to
+// the cache format version
+string HipBinCache::manifestKey(const string& inputKey) {
+  HipBinHash hash;
+  hash.update(HIPCC_CACHE_VERSION);
+  hash.update(inputKey);
+  return hash.hexDigest();
+}
+
+// finds the result of an earlier compile whose headers are all unchanged
+bool HipBinCache::lookup(const string& manifestKey, const HipCCJob& job,
+                         string& resultKey) const {
+  string manifest;
+  if (!hipBinUtilPtr_->readFile(entryPath(manifestKey, ".manifest").string(),
+                                manifest) ||
+      !matchManifest(manifest, job, resultKey, hipBinUtilPtr_))
+    return false;
+  touch(entryPath(manifestKey, ".manifest"));
+  return true;
+}
+
+// returns the result key of the newest manifest entry whose headers match
+// the ones on disk. A header whose size and mtime match the recorded ones is
+// trusted without hashing it. Paths under the job's base directory are
+// stored relative to it.
+bool HipBinCache::matchManifest(const string& manifest, const HipCCJob& job,
+                                string& resultKey,
+                                HipBinUtil* hipBinUtilPtr) {
+  std::istringstream in(manifest);
+  string line;
+  if (!std::getline(in, line) || line != HIPCC_CACHE_VERSION)
+    return false;
+
+  // entries are appended, so the newest is checked first
+  vector<std::pair<string, vector<string>>> entries;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 2, "R ") == 0)
+      entries.push_back({line.substr(2), {}});
+    else if (line.compare(0, 2, "F ") == 0 && !entries.empty())
+      entries.back().second.push_back(line.substr(2));
+  }
+  map<string, string> hashes;
+  for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry) {
+    bool match = true;
+    for (auto& file : entry->second) {
+      // F <hash> <size> <mtime> <path>
+      std::istringstream fields(file);
+      string hash, size, mtime, path;
+      fields >> hash >> size >> mtime;
+      std::getline(fields >> std::ws, path);
+      path = job.localPath(path, hipBinUtilPtr);
+      std::error_code ec;
+      auto curSize = fs::file_size(path, ec);
+      if (ec || std::to_string(curSize) != size) {
+        match = false;
+        break;
+      }
+      auto curMtime = fs::last_write_time(path, ec).time_since_epoch().count();
+      if (!ec && std::to_string(curMtime) == mtime)
+        continue;
+      if (hashes.find(path) == hashes.end())
+        hashes[path] = hipBinUtilPtr->hashFile(path);
+      if (hashes[path] != hash) {
+        match = false;
+        break;
+      }
+    }
+    if (match) {
+      resultKey = entry->first;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HipBinCache::readResult(const string& resultKey,
+                             HipCCResult& result) const {
+  fs::path path = entryPath(resultKey, ".result");
+  string packed;
+  if (!hipBinUtilPtr_->readFile(path.string(), packed) ||
+      !unpackResult(packed, result))
+    return false;
+  touch(path);
+  return true;
+}
+
+// writes the cached object (and dependency file) in place of the compile.
+// The result may come from a compile with another output path, so the
+// dependency file is retargeted.
+bool HipBinCache::restore(const HipCCJob& job, const HipCCResult& result,
+                          HipBinUtil* hipBinUtilPtr) {
+  if (!hipBinUtilPtr->writeFileAtomic(job.output, result.object))
+    return false;
+  if (job.writesDeps &&
+      !hipBinUtilPtr->writeFileAtomic(job.depFile, job.retargetDepFile(
+                                      job.localPath(result.depFile,
+                                                    hipBinUtilPtr))))
+    return false;
+  return true;
+}
+
+// builds the manifest entry of a compile which read the includes, its
+// result key is derived from the manifest key and the header hashes. Empty
+// when an include was modified at or after the start of the compile, which
+// is taken at whole seconds for file systems with coarse timestamps.
+string HipBinCache::manifestEntry(const string& manifestKey,
+                                  const vector<string>& includes,
+                                  const HipCCJob& job,
+                                  fs::file_time_type compileStart,
+                                  string& resultKey,
+                                  HipBinUtil* hipBinUtilPtr) {
+  auto tooNew = fs::file_time_type(std::chrono::duration_cast<
+                std::chrono::seconds>(compileStart.time_since_epoch()));
+  HipBinHash hash;
+  hash.update(manifestKey);
+  string fileLines;
+  for (auto& include : includes) {
+    std::error_code ec;
+    auto size = fs::file_size(include, ec);
+    if (ec)
+      continue;
+    auto modified = fs::last_write_time(include, ec);
+    if (!ec && modified >= tooNew)
+      return "";
+    auto mtime = modified.time_since_epoch().count();
+    string fileHash = hipBinUtilPtr->hashFile(include);
+    string path = job.portablePath(include);
+    hash.update(path);
+    hash.update(fileHash);
+    fileLines += "F " + fileHash + " " + std::to_string(size) + " " +
+                 std::to_string(mtime) + " " + path + "\n";
+  }
+  resultKey = hash.hexDigest();
+  return "R " + resultKey + "\n" + fileLines;
+}
+
+// returns the manifest with the entry added as the newest one, replacing an
+// older entry of the same result and dropping the oldest ones
+string HipBinCache::addToManifest(const string& manifest,
+                                  const string& resultKey,
+                                  const string& entry) {
+  vector<string> entries;
+  std::istringstream in(manifest);
+  string line;
+  bool skipEntry = false;
+  if (std::getline(in, line) && line == HIPCC_CACHE_VERSION) {
+    while (std::getline(in, line)) {
+      if (line.compare(0, 2, "R ") == 0) {
+        skipEntry = line == "R " + resultKey;
+        if (!skipEntry)
+          entries.push_back(line + "\n");
+      } else if (!skipEntry && !entries.empty()) {
+        entries.back() += line + "\n";
+      }
+    }
+  }
+  entries.push_back(entry);
+  if (entries.size() > HIPCC_CACHE_MANIFEST_MAX)
+    entries.erase(entries.begin(),
+                  entries.end() - HIPCC_CACHE_MANIFEST_MAX);
+  string updated = string(HIPCC_CACHE_VERSION) + "\n";
+  for (auto& kept : entries)
+    updated += kept;
+  return updated;
+}
+
+// stores the result and adds its entry to the manifest
+void HipBinCache::store(const string& manifestKey, const string& resultKey,
+                        const string& entry, const HipCCResult& result) {
+  fs::path resultPath = entryPath(resultKey, ".result");
+  std::error_code ec;
+  fs::create_directories(resultPath.parent_path(), ec);
+  string packed = packResult(result);
+  if (!fs::exists(resultPath) &&
+      hipBinUtilPtr_->writeFileAtomic(resultPath.string(), packed))
+    addToShard(resultKey, packed.size());
+
+  fs::path manifestPath = entryPath(manifestKey, ".manifest");
+  fs::create_directories(manifestPath.parent_path(), ec);
+  HipBinFileLock lock(manifestPath.string() + ".lock");
+  string manifest;
+  hipBinUtilPtr_->readFile(manifestPath.string(), manifest);
+  string updated = addToManifest(manifest, resultKey, entry);
+  if (hipBinUtilPtr_->writeFileAtomic(manifestPath.string(), updated))
+    addToShard(manifestKey, static_cast<int64_t>(updated.size()) -
+                            static_cast<int64_t>(manifest.size()));
+}
+
+void HipBinCache::touch(const fs::path& path) const {
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+}
+
+// updates the byte total of the key's shard and trims the shard when it
+// outgrew its part of the size limit
+void HipBinCache::addToShard(const string& key, int64_t bytes) {
+  fs::path shardDir = cacheDir_ / key.substr(0, 1);
+  fs::path statsPath = shardDir / "stats";
+  HipBinFileLock lock((shardDir / "stats.lock").string());
+  string stats;
+  int64_t total = 0;
+  if (hipBinUtilPtr_->readFile(statsPath.string(), stats))
+    total = std::strtoll(stats.c_str(), nullptr, 10);
+  total = std::max<int64_t>(0, total + bytes);
+  uint64_t limit = maxSize_ / HIPCC_CACHE_SHARDS;
+  if (static_cast<uint64_t>(total) > limit) {
+    cleanShard(shardDir, limit);
+    return;
+  }
+  hipBinUtilPtr_->writeFileAtomic(statsPath.string(), std::to_string(total));
+}
+
+// removes the least recently used entries of the shard until it is below
+// 80% of its limit and rewrites the shard's byte total
+void HipBinCache::cleanShard(const fs::path& shardDir, uint64_t limit) {
+  vector<std::pair<fs::file_time_type, fs::path>> files;
+  map<string, uint64_t> sizes;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (auto& entry : fs::directory_iterator(shardDir, ec)) {
+    string ext = entry.path().extension().string();
+    if (ext != ".result" && ext != ".manifest")
+      continue;
+    uint64_t size = fs::file_size(entry.path(), ec);
+    if (ec)
+      continue;
+    files.push_back({fs::last_write_time(entry.path(), ec), entry.path()});
+    sizes[entry.path().string()] = size;
+    total += size;
+  }
+  std::sort(files.begin(), files.end());
+  for (auto& file : files) {
+    if (total <= limit * 8 / 10)
+      break;
+    if (fs::remove(file.second, ec))
+      total -= sizes[file.second.string()];
+  }
+  hipBinUtilPtr_->writeFileAtomic((shardDir / "stats").string(),
+                                  std::to_string(total));
+}
+
+// serializes a result as "HIPCC_CACHE_VERSION\n" followed by
+// "<name> <size>\n<bytes>" sections
+string HipBinCache::packResult(const HipCCResult& result) {
+  string packed = string(HIPCC_CACHE_VERSION) + "\n";
+  vector<std::pair<string, const string*>> sections = {
+    {"object", &result.object}, {"stdout", &result.stdoutText},
+    {"stderr", &result.stderrText}, {"depfile", &result.depFile} };
+  for (auto& section : sections) {
+    packed += section.first + " " + std::to_string(section.second->size()) +
+              "\n" + *section.second;
+  }
+  return packed;
+}
+
+bool HipBinCache::unpackResult(const string& packed, HipCCResult& result) {
+  string header = string(HIPCC_CACHE_VERSION) + "\n";
+  if (packed.compare(0, header.size(), header) != 0)
+    return false;
+  map<string, string*> sections = {
+    {"object", &result.object}, {"stdout", &result.stdoutText},
+    {"stderr", &result.stderrText}, {"depfile", &result.depFile} };
+  size_t pos = header.size();
+  while (pos < packed.size()) {
+    size_t eol = packed.find('\n', pos);
+    if (eol == string::npos)
+      return false;
+    std::istringstream line(packed.substr(pos, eol - pos));
+    string name;
+    size_t size = 0;
+    if (!(line >> name >> size) || eol + 1 + size > packed.size())
+      return false;
+    auto it = sections.find(name);
+    if (it != sections.end())
+      *it->second = packed.substr(eol + 1, size);
+    pos = eol + 1 + size;
+  }
+  return true;
+}
+
+/**
+ * Remote compilation result cache shared by a fleet (HIPCC_REMOTE_CACHE).
+ *
+ * Uses the keys and formats of the local cache over plain HTTP:
+ * GET/PUT <url>/<manifestKey>.manifest and <url>/<resultKey>.result.
+ * Any failure counts as a miss, and after the first one the server is not
+ * contacted again by this invocation, so a slow or unreachable server costs
+ * at most one timeout before the compile runs locally.
+ */
+class HipBinRemoteCache {
+ public:
+  HipBinRemoteCache(const string& url, const string& timeoutMs,
+                    HipBinUtil* hipBinUtilPtr);
+  bool lookup(const string& manifestKey, const HipCCJob& job,
+              HipCCResult& result);
+  void store(const string& manifestKey, const string& resultKey,
+             const string& entry, const HipCCResult& result);
+  bool failed() const { return failed_; }
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  HipBinHttpClient client_;
+  string manifest_;       // manifest as fetched by lookup
+  bool failed_ = false;
+};
+
+HipBinRemoteCache::HipBinRemoteCache(const string& url,
+                                     const string& timeoutMs,
+                                     HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr),
+    client_(url, std::atoi(timeoutMs.c_str())) {
+  failed_ = !client_.valid();
+}
+
+bool HipBinRemoteCache::lookup(const string& manifestKey,
+                               const HipCCJob& job, HipCCResult& result) {
+  if (failed_)
+    return false;
+  int status = client_.get(manifestKey + ".manifest", manifest_);
+  if (status != 200) {
+    failed_ = status != 404;
+    manifest_.clear();
+    return false;
+  }
+  string resultKey, packed;
+  if (!HipBinCache::matchManifest(manifest_, job, resultKey, hipBinUtilPtr_))
+    return false;
+  status = client_.get(resultKey + ".result", packed);
+  failed_ = status != 200 && status != 404;
+  return status == 200 && HipBinCache::unpackResult(packed, result);
+}
+
+// uploads the result, then the manifest fetched by lookup with the entry
+// added. Concurrent uploads of the same manifest keep the last one.
+void HipBinRemoteCache::store(const string& manifestKey,
+                              const string& resultKey, const string& entry,
+                              const HipCCResult& result) {
+  if (failed_)
+    return;
+  if (client_.put(resultKey + ".result",
+                  HipBinCache::packResult(result)) / 100 != 2) {
+    failed_ = true;
+    return;
+  }
+  string updated = HipBinCache::addToManifest(manifest_, resultKey, entry);
+  failed_ = client_.put(manifestKey + ".manifest", updated) / 100 != 2;
+}
+
+#endif  // SRC_HIPBIN_CACHE_H_
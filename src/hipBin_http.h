@@ -0,0 +1,334 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_HTTP_H_
+#define SRC_HIPBIN_HTTP_H_
+
+#include "hipBin_util.h"
+#include <chrono>
+#include <vector>
+#include <string>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+# define HIPCC_HTTP_DEFAULT_TIMEOUT_MS  2000
+
+/**
+ * Minimal HTTP/1.1 client for the remote compile cache: GET and PUT of
+ * whole blobs over plain http://host[:port][/prefix] URLs, one connection
+ * per request. The connect, send and receive of a request share one
+ * deadline, so an unreachable, stalled or slowly sending server costs at
+ * most the timeout per request. The host name is resolved once, by the
+ * constructor, and that lookup is not bounded by the timeout; a client
+ * whose host does not resolve is not valid.
+ * Requests return the HTTP status, or -1 when no response was received.
+ * Not available on Windows, where requests always fail.
+ */
+class HipBinHttpClient {
+ public:
+  HipBinHttpClient(const string& url, int timeoutMs);
+  bool valid() const { return !addrs_.empty(); }
+  int get(const string& name, string& body) const;
+  int put(const string& name, const string& body) const;
+
+ private:
+  // the resolved addresses of the host
+  struct Address {
+    int family, socktype, protocol;
+    string addr;
+  };
+  string host_, port_, prefix_;
+  vector<Address> addrs_;
+  int timeoutMs_;
+  void resolve();
+  int request(const string& method, const string& name, const string& body,
+              string& response) const;
+};
+
+HipBinHttpClient::HipBinHttpClient(const string& url, int timeoutMs)
+  : timeoutMs_(timeoutMs > 0 ? timeoutMs : HIPCC_HTTP_DEFAULT_TIMEOUT_MS) {
+  std::smatch match;
+  if (!std::regex_match(url, match,
+                        regex("^http://([^/:]+)(:([0-9]+))?(/.*)?$")))
+    return;
+  host_ = match[1];
+  port_ = match[3].length() ? match[3].str() : "80";
+  prefix_ = match[4];
+  while (!prefix_.empty() && prefix_.back() == '/')
+    prefix_.pop_back();
+  resolve();
+}
+
+int HipBinHttpClient::get(const string& name, string& body) const {
+  return request("GET", name, "", body);
+}
+
+int HipBinHttpClient::put(const string& name, const string& body) const {
+  string response;
+  return request("PUT", name, body, response);
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+void HipBinHttpClient::resolve() {}
+
+int HipBinHttpClient::request(const string& method, const string& name,
+                              const string& body, string& response) const {
+  return -1;
+}
+#else
+// looks up the addresses of the host, once for all requests
+void HipBinHttpClient::resolve() {
+  if (host_.empty())
+    return;
+  struct addrinfo hints = {}, *addrs = nullptr;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &addrs) != 0)
+    return;
+  for (auto addr = addrs; addr; addr = addr->ai_next)
+    addrs_.push_back({ addr->ai_family, addr->ai_socktype, addr->ai_protocol,
+                       string(reinterpret_cast<char*>(addr->ai_addr),
+                              addr->ai_addrlen) });
+  freeaddrinfo(addrs);
+}
+
+int HipBinHttpClient::request(const string& method, const string& name,
+                              const string& body, string& response) const {
+  if (!valid())
+    return -1;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeoutMs_);
+  // waits for the events until the deadline, true when they happened
+  auto wait = [&](int fd, short events) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+    struct pollfd pfd = { fd, events, 0 };
+    return left > 0 && poll(&pfd, 1, static_cast<int>(left)) == 1;
+  };
+  int fd = -1;
+  for (size_t i = 0; i < addrs_.size() && fd < 0; i++) {
+    const Address& addr = addrs_[i];
+    fd = socket(addr.family, addr.socktype | SOCK_NONBLOCK, addr.protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(
+                addr.addr.data()), addr.addr.size()) != 0) {
+      int err = errno;
+      socklen_t len = sizeof(err);
+      if (err != EINPROGRESS || !wait(fd, POLLOUT) ||
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  if (fd < 0)
+    return -1;
+
+  string out = method + " " + prefix_ + "/" + name + " HTTP/1.1\r\n" +
+               "Host: " + host_ + "\r\nConnection: close\r\n" +
+               "Content-Length: " + std::to_string(body.size()) +
+               "\r\n\r\n" + body;
+  size_t sent = 0;
+  while (sent < out.size()) {
+    ssize_t bytes = wait(fd, POLLOUT) ?
+        send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL) : -1;
+    if (bytes <= 0) {
+      close(fd);
+      return -1;
+    }
+    sent += bytes;
+  }
+  string in;
+  char buffer[1 << 16];
+  while (true) {
+    ssize_t bytes = wait(fd, POLLIN) ?
+        recv(fd, buffer, sizeof(buffer), 0) : -1;
+    if (bytes < 0) {
+      close(fd);
+      return -1;
+    }
+    if (bytes == 0)
+      break;
+    in.append(buffer, bytes);
+  }
+  close(fd);
+
+  // status line and headers, then a Content-Length, chunked or
+  // connection delimited body
+  size_t headerEnd = in.find("\r\n\r\n");
+  int status = 0;
+  if (headerEnd == string::npos ||
+      sscanf(in.c_str(), "HTTP/%*d.%*d %d", &status) != 1)
+    return -1;
+  string headers = in.substr(0, headerEnd);
+  std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+  string payload = in.substr(headerEnd + 4);
+  std::smatch match;
+  if (std::regex_search(headers, match,
+                        regex("\r\ntransfer-encoding: *chunked"))) {
+    response.clear();
+    size_t pos = 0;
+    while (true) {
+      size_t eol = payload.find("\r\n", pos);
+      if (eol == string::npos)
+        return -1;
+      size_t size = std::strtoul(payload.c_str() + pos, nullptr, 16);
+      if (size == 0)
+        break;
+      if (eol + 2 + size > payload.size())
+        return -1;
+      response.append(payload, eol + 2, size);
+      pos = eol + 2 + size + 2;
+    }
+  } else if (std::regex_search(headers, match,
+                               regex("\r\ncontent-length: *([0-9]+)"))) {
+    size_t size = std::strtoul(match[1].str().c_str(), nullptr, 10);
+    if (payload.size() < size)
+      return -1;
+    response = payload.substr(0, size);
+  } else {
+    response = payload;
+  }
+  return status;
+}
+#endif
+
+/**
+ * Stand-in for the remote cache server (hipcc --hipcc-cache-server), so the
+ * remote cache can be used and tested without any other service. It stores
+ * each PUT body as a file in the directory and serves it back on GET, one
+ * connection at a time. Names are restricted to [A-Za-z0-9._-].
+ */
+class HipBinHttpServer {
+ public:
+  explicit HipBinHttpServer(const string& dir) : dir_(dir) {}
+  int serve(int port);
+
+ private:
+  fs::path dir_;
+#if !defined(_WIN32) && !defined(_WIN64)
+  void handle(int fd, HipBinUtil* hipBinUtilPtr) const;
+#endif
+};
+
+#if defined(_WIN32) || defined(_WIN64)
+int HipBinHttpServer::serve(int port) {
+  std::cerr << "The hipcc cache server is not supported on Windows" << endl;
+  return -1;
+}
+#else
+int HipBinHttpServer::serve(int port) {
+  std::error_code ec;
+  fs::create_directories(dir_, ec);
+  int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  socklen_t len = sizeof(addr);
+  if (listenFd < 0 || bind(listenFd, (struct sockaddr*)&addr, len) != 0 ||
+      listen(listenFd, 64) != 0 ||
+      getsockname(listenFd, (struct sockaddr*)&addr, &len) != 0) {
+    std::cerr << "hipcc cache server: unable to listen on port " << port
+              << endl;
+    return -1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  cout << "hipcc cache server: serving " << dir_.string()
+       << " on port " << ntohs(addr.sin_port) << endl;
+  HipBinUtil* hipBinUtilPtr = HipBinUtil::getInstance();
+  while (true) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+    struct timeval timeout = { 10, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    handle(fd, hipBinUtilPtr);
+    close(fd);
+  }
+  return 0;
+}
+
+void HipBinHttpServer::handle(int fd, HipBinUtil* hipBinUtilPtr) const {
+  string in;
+  char buffer[1 << 16];
+  size_t headerEnd;
+  while ((headerEnd = in.find("\r\n\r\n")) == string::npos) {
+    ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+    if (bytes <= 0)
+      return;
+    in.append(buffer, bytes);
+  }
+  char method[8], target[256];
+  if (sscanf(in.c_str(), "%7s %255s", method, target) != 2)
+    return;
+  string headers = in.substr(0, headerEnd);
+  std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+  std::smatch match;
+  size_t length = 0;
+  if (std::regex_search(headers, match,
+                        regex("\r\ncontent-length: *([0-9]+)")))
+    length = std::strtoul(match[1].str().c_str(), nullptr, 10);
+  string body = in.substr(headerEnd + 4);
+  while (body.size() < length) {
+    ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+    if (bytes <= 0)
+      return;
+    body.append(buffer, bytes);
+  }
+
+  string name = fs::path(target).filename().string();
+  string status = "400 Bad Request", reply;
+  if (!std::regex_match(name, regex("^[A-Za-z0-9_-][A-Za-z0-9._-]*$"))) {
+    // keep the bad request status
+  } else if (string(method) == "GET") {
+    status = hipBinUtilPtr->readFile((dir_ / name).string(), reply) ?
+             "200 OK" : "404 Not Found";
+  } else if (string(method) == "PUT") {
+    status = hipBinUtilPtr->writeFileAtomic((dir_ / name).string(), body) ?
+             "201 Created" : "500 Internal Server Error";
+  } else {
+    status = "405 Method Not Allowed";
+  }
+  string out = "HTTP/1.1 " + status + "\r\nConnection: close\r\n" +
+               "Content-Length: " + std::to_string(reply.size()) +
+               "\r\n\r\n" + reply;
+  for (size_t sent = 0; sent < out.size();) {
+    ssize_t bytes = send(fd, out.data() + sent, out.size() - sent, 0);
+    if (bytes <= 0)
+      return;
+    sent += bytes;
+  }
+}
+#endif
+
+#endif  // SRC_HIPBIN_HTTP_H_
@@ -0,0 +1,227 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_JOB_H_
+#define SRC_HIPBIN_JOB_H_
+
+#include "hipBin_util.h"
+#include <vector>
+#include <string>
+
+// environment variables read by clang itself which change its output
+const vector<string> hipccClangEnv = {
+  "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "SOURCE_DATE_EPOCH",
+  "HIP_DEVICE_LIB_PATH", "CCC_OVERRIDE_OPTIONS", "ROCM_PATH", "HIP_PATH" };
+
+/**
+ * @brief What a hipcc invocation reads and writes, taken from the user
+ * arguments independently of the platform specific command construction.
+ * Used by the driver features that wrap the final command (caching, up to
+ * date checks, ...).
+ */
+class HipCCJob {
+ public:
+  vector<string> sources;         // C, C++ and HIP sources
+  vector<string> inputs;          // objects, archives and other inputs
+  string output;                  // -o or the default output of -c
+  string depFile;                 // -MF or the -MD default next to output
+  string depTarget;               // -MT or -MQ
+  string baseDir;                 // HIPCC_BASE_DIR, normalized
+  bool compileOnly = false;       // -c or --genco
+  bool preprocessOnly = false;    // -E, -M, -MM, -fsyntax-only, ...
+  bool writesDeps = false;        // -MD, -MMD or -MF
+  // -save-temps, -ftime-trace, @response files, ... whose inputs or
+  // outputs hipcc does not see
+  bool hasOpaqueArgs = false;
+
+  /**
+   * @brief Parse the user arguments, argv[0] excluded
+   */
+  void parse(const vector<string>& args) {
+    // options taking their value as the next argument
+    static const vector<string> valueOpts = {
+      "-x", "-I", "-D", "-U", "-include", "-isystem",
+      "-iquote", "-idirafter", "-imacros", "-include-pch", "-Xclang",
+      "-Xlinker", "-Xarch_host", "-Xarch_device", "-Xoffload-linker",
+      "-mllvm", "-L", "-l", "-target", "-arch", "-isysroot", "-MJ" };
+    for (size_t i = 0; i < args.size(); i++) {
+      const string& arg = args.at(i);
+      if (arg.empty()) {
+        continue;
+      } else if (arg == "-o" && i + 1 < args.size()) {
+        output = args.at(++i);
+      } else if (arg.size() > 2 && arg.compare(0, 2, "-o") == 0) {
+        output = arg.substr(2);
+      } else if (arg == "-MF" && i + 1 < args.size()) {
+        depFile = args.at(++i);
+        writesDeps = true;
+      } else if ((arg == "-MT" || arg == "-MQ") && i + 1 < args.size()) {
+        if (depTarget.empty())
+          depTarget = args.at(i + 1);
+        i++;
+      } else if (arg == "-MD" || arg == "-MMD") {
+        writesDeps = true;
+      } else if (arg == "-c" || arg == "--genco") {
+        compileOnly = true;
+      } else if (arg == "-E" || arg == "-M" || arg == "-MM" ||
+                 arg == "-fsyntax-only" || arg == "-S" ||
+                 arg == "--analyze" || arg == "-###") {
+        preprocessOnly = true;
+      } else if (arg.compare(0, 11, "-save-temps") == 0 ||
+                 arg.compare(0, 12, "-ftime-trace") == 0 ||
+                 arg == "-gsplit-dwarf" || arg == "-" || arg[0] == '@') {
+        hasOpaqueArgs = true;
+      } else if (std::find(valueOpts.begin(), valueOpts.end(), arg) !=
+                 valueOpts.end()) {
+        i++;
+      } else if (arg[0] == '-') {
+        continue;
+      } else if (isSource(arg)) {
+        sources.push_back(arg);
+      } else {
+        inputs.push_back(arg);
+      }
+    }
+    // clang names the object of a single -c compile after the source
+    if (output.empty() && compileOnly && sources.size() == 1) {
+      fs::path obj = fs::path(sources.at(0)).filename();
+      obj.replace_extension(".o");
+      output = obj.string();
+    }
+    if (writesDeps && depFile.empty() && !output.empty()) {
+      fs::path dep = output;
+      dep.replace_extension(".d");
+      depFile = dep.string();
+    }
+  }
+
+  /**
+   * @brief True for a compile of exactly one source into one object, the
+   * only kind of invocation whose result can be reused as a whole
+   */
+  bool isSingleCompile() const {
+    return compileOnly && !preprocessOnly && !hasOpaqueArgs &&
+           sources.size() == 1 && !output.empty() && output != "-";
+  }
+
+  /**
+   * @brief Hash of everything known about the compile before running it:
+   * the final command with the output, depfile and depfile target masked,
+   * the compiler identity, the working directory, the environment clang
+   * reads and the source contents. Two invocations with the same key
+   * produce the same object. Paths under baseDir are hashed relative to
+   * it, so that the key does not depend on the workspace location.
+   */
+  string inputKey(const string& CMD, const string& compilerId,
+                  const HipBinUtil* hipBinUtilPtr) const {
+    HipBinHash hash;
+    hash.update(compilerId);
+    hash.update(portablePath(fs::current_path().string()));
+    for (auto& arg : hipBinUtilPtr->splitCmdLine(CMD)) {
+      if (!output.empty() && arg == output)
+        hash.update("@OUT@");
+      else if (!depFile.empty() && arg == depFile)
+        hash.update("@DEP@");
+      else if (!depTarget.empty() && arg == depTarget)
+        hash.update("@TGT@");
+      else
+        hash.update(portablePath(arg));
+    }
+    for (auto& name : hipccClangEnv) {
+      const char* value = std::getenv(name.c_str());
+      hash.update(name + "=" + (value ? value : ""));
+    }
+    for (auto& source : sources) {
+      hash.update(hipBinUtilPtr->hashFile(source));
+    }
+    return hash.hexDigest();
+  }
+
+  /**
+   * @brief Replace baseDir in the paths of the text with a placeholder, for
+   * what is stored in caches shared between workspaces
+   */
+  string portablePath(const string& text) const {
+    if (baseDir.empty())
+      return text;
+    // only whole path components, /ws must not match in /ws2
+    string portable;
+    size_t start = 0, pos;
+    while ((pos = text.find(baseDir, start)) != string::npos) {
+      size_t end = pos + baseDir.size();
+      bool whole = end == text.size() ||
+                   string("/\\=:;\" ").find(text[end]) != string::npos;
+      portable.append(text, start, pos - start);
+      portable += whole ? "@BASE@" : baseDir;
+      start = end;
+    }
+    return portable.append(text, start, string::npos);
+  }
+
+  /**
+   * @brief Undo portablePath with this job's baseDir
+   */
+  string localPath(const string& text, const HipBinUtil* hipBinUtilPtr)
+                   const {
+    if (baseDir.empty())
+      return text;
+    return hipBinUtilPtr->replaceAllStr(text, "@BASE@", baseDir);
+  }
+
+  /**
+   * @brief Replace the target of the first rule of a dependency file written
+   * for another output of the same compile with this job's target
+   */
+  string retargetDepFile(const string& contents) const {
+    size_t colon = string::npos;
+    for (size_t i = 0; i + 1 < contents.size(); i++) {
+      if (contents[i] == '\\') {
+        i++;
+      } else if (contents[i] == ':' && isspace(contents[i + 1])) {
+        colon = i;
+        break;
+      }
+    }
+    if (colon == string::npos)
+      return contents;
+    string target = depTarget.empty() ? output : depTarget;
+    string escaped;
+    for (char c : target) {
+      if (c == ' ' || c == '#')
+        escaped += '\\';
+      if (c == '$')
+        escaped += '$';
+      escaped += c;
+    }
+    return escaped + contents.substr(colon);
+  }
+
+  static bool isSource(const string& arg) {
+    static const vector<string> extensions = {
+      ".c", ".cc", ".cpp", ".cxx", ".C", ".cu", ".cuh", ".hip" };
+    string ext = fs::path(arg).extension().string();
+    return std::find(extensions.begin(), extensions.end(), ext) !=
+           extensions.end();
+  }
+};
+
+#endif  // SRC_HIPBIN_JOB_H_
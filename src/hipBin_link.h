@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_LINK_H_
+#define SRC_HIPBIN_LINK_H_
+
+#include "hipBin_util.h"
+#include "hipBin_job.h"
+#include "hipBin_tasks.h"
+#include "hipBin_plan.h"
+#include <vector>
+#include <string>
+
+# define HIPCC_EXTRACT_VERSION "hipcc-extract-1"
+
+/**
+ * Parallel device linking of -fgpu-rdc links (HIPCC_PARALLEL_LINK).
+ *
+ * The jobs the clang driver runs for the link are captured with -###, as
+ * for HIPCC_DIRECT_CC1, and run directly: the unbundling of the inputs and
+ * the device link of each offload target run in parallel, the fat binary
+ * and the host link after them. With HIPCC_LINK_PARTITIONS each device
+ * link also splits its LTO code generation into partitions (lld
+ * --lto-partitions), so one large target uses several cores. This changes
+ * the generated code and needs an lld accepting the option for amdgcn, so
+ * it is off by default; "auto" shares the job limit out between the device
+ * links.
+ *
+ * With an extraction cache (HIPCC_RDC_CACHE_DIR) the device code unbundled
+ * from each object or archive is kept as <dir>/<key>-<n>.o, where the key
+ * hashes the contents of the input and the bundler arguments other than
+ * the file names. Unbundle jobs whose outputs are cached are not run, so
+ * a relink after a change of one object only extracts that object.
+ */
+class HipBinDeviceLink {
+ public:
+  HipBinDeviceLink(const string& tmpDir, HipBinUtil* hipBinUtilPtr);
+  static bool applies(const vector<string>& args, const HipCCJob& job);
+  bool prepare(const string& cmdline, const HipCCJob& job,
+               const string& compilerId, int partitions, int maxJobs,
+               const string& redirect);
+  void setExtractCache(const string& dir) { extractCacheDir_ = dir; }
+  const vector<HipccTask>& getTasks() const { return tasks_; }
+  void storeExtracted() const;
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  string tmpDir_, extractCacheDir_;
+  vector<HipccTask> tasks_;
+  // outputs of the unbundle jobs which run, with their cache entries
+  vector<std::pair<string, string>> extracted_;
+  static bool isDeviceLink(const vector<string>& args);
+  void useExtractCache();
+};
+
+HipBinDeviceLink::HipBinDeviceLink(const string& tmpDir,
+                                   HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr), tmpDir_(tmpDir) {}
+
+// true for the link of -fgpu-rdc objects, whose device code is linked by
+// the driver
+bool HipBinDeviceLink::applies(const vector<string>& args,
+                               const HipCCJob& job) {
+  if (job.compileOnly || job.preprocessOnly || job.hasOpaqueArgs ||
+      !job.sources.empty() || job.output.empty())
+    return false;
+  bool rdc = false, hipLink = false;
+  for (auto& arg : args) {
+    if (arg == "-fgpu-rdc")
+      rdc = true;
+    else if (arg == "-fno-gpu-rdc")
+      rdc = false;
+    hipLink = hipLink || arg == "--hip-link";
+  }
+  return rdc && hipLink;
+}
+
+// true for the lld job linking the device code of one target
+bool HipBinDeviceLink::isDeviceLink(const vector<string>& args) {
+  if (args.empty())
+    return false;
+  string tool = fs::path(args[0]).filename().string();
+  return (tool == "lld" || tool == "ld.lld") &&
+         std::find(args.begin(), args.end(), "elf64_amdgpu") != args.end();
+}
+
+// captures the driver jobs of the link and adds the LTO partitions to the
+// device links, or shares maxJobs out between them when partitions is 0.
+// False when the jobs can not be captured.
+bool HipBinDeviceLink::prepare(const string& cmdline, const HipCCJob& job,
+                               const string& compilerId, int partitions,
+                               int maxJobs, const string& redirect) {
+  HipccPlanNames names = { {"@OUT@", job.output} };
+  HipBinPlan plan((fs::path(tmpDir_) / "plan").string(), hipBinUtilPtr_);
+  if (!plan.load(cmdline, names, compilerId))
+    return false;
+  tasks_ = plan.bind(names, tmpDir_, "");
+  vector<size_t> deviceLinks;
+  for (size_t i = 0; i < tasks_.size(); i++) {
+    vector<string> args = hipBinUtilPtr_->splitCmdLine(tasks_[i].cmd);
+    bool hasPartitions = false;
+    for (auto& arg : args)
+      hasPartitions = hasPartitions ||
+                      arg.compare(0, 16, "--lto-partitions") == 0;
+    if (isDeviceLink(args) && !hasPartitions)
+      deviceLinks.push_back(i);
+  }
+  if (deviceLinks.empty())
+    return false;
+  if (partitions == 0)
+    partitions = std::max<int>(1, maxJobs /
+                               static_cast<int>(deviceLinks.size()));
+  for (auto i : deviceLinks) {
+    if (partitions > 1)
+      tasks_[i].cmd += " --lto-partitions=" + std::to_string(partitions);
+  }
+  if (!extractCacheDir_.empty())
+    useExtractCache();
+  for (auto& task : tasks_)
+    task.cmd += redirect;
+  return true;
+}
+
+// copies the cached outputs of the unbundle jobs and drops those jobs
+void HipBinDeviceLink::useExtractCache() {
+  vector<HipccTask> tasks;
+  vector<size_t> index(tasks_.size(), tasks_.size());
+  std::error_code ec;
+  fs::create_directories(extractCacheDir_, ec);
+  for (size_t i = 0; i < tasks_.size(); i++) {
+    vector<string> args = hipBinUtilPtr_->splitCmdLine(tasks_[i].cmd);
+    vector<string> inputs, outputs;
+    bool unbundle = !args.empty() &&
+                    fs::path(args[0]).filename() == "clang-offload-bundler" &&
+                    std::find(args.begin(), args.end(), "-unbundle") !=
+                    args.end();
+    HipBinHash hash;
+    hash.update(HIPCC_EXTRACT_VERSION);
+    for (size_t a = 1; a < args.size(); a++) {
+      if (args[a].compare(0, 7, "-input=") == 0) {
+        inputs.push_back(args[a].substr(7));
+      } else if (args[a].compare(0, 8, "-output=") == 0) {
+        outputs.push_back(args[a].substr(8));
+      } else {
+        hash.update(args[a]);
+      }
+    }
+    if (!unbundle || inputs.size() != 1 || outputs.empty()) {
+      index[i] = tasks.size();
+      tasks.push_back(tasks_[i]);
+      continue;
+    }
+    hash.update(hipBinUtilPtr_->hashFile(inputs[0]));
+    string key = hash.hexDigest();
+    bool cached = true;
+    vector<std::pair<string, string>> entries;
+    for (size_t o = 0; o < outputs.size(); o++) {
+      string entry = (fs::path(extractCacheDir_) /
+                      (key + "-" + std::to_string(o) + ".o")).string();
+      entries.push_back({outputs[o], entry});
+      cached = cached && fs::exists(entry, ec);
+    }
+    for (auto& entry : entries) {
+      cached = cached && fs::copy_file(entry.second, entry.first,
+                                       fs::copy_options::overwrite_existing,
+                                       ec);
+    }
+    if (cached)
+      continue;
+    extracted_.insert(extracted_.end(), entries.begin(), entries.end());
+    index[i] = tasks.size();
+    tasks.push_back(tasks_[i]);
+  }
+  // the dependencies on dropped jobs are met already
+  for (auto& task : tasks) {
+    vector<size_t> deps;
+    for (auto dep : task.deps) {
+      if (index[dep] < tasks_.size())
+        deps.push_back(index[dep]);
+    }
+    task.deps = deps;
+  }
+  tasks_ = tasks;
+}
+
+// stores the outputs of the unbundle jobs which ran in the cache
+void HipBinDeviceLink::storeExtracted() const {
+  for (auto& entry : extracted_) {
+    std::error_code ec;
+    string tmp = entry.second + ".tmp" + std::to_string(getpid());
+    if (fs::copy_file(entry.first, tmp, fs::copy_options::overwrite_existing,
+                      ec))
+      fs::rename(tmp, entry.second, ec);
+    if (ec)
+      fs::remove(tmp, ec);
+  }
+}
+
+#endif  // SRC_HIPBIN_LINK_H_
@@ -0,0 +1,131 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_LINKER_H_
+#define SRC_HIPBIN_LINKER_H_
+
+#include "hipBin_util.h"
+#include "hipBin_job.h"
+#include <vector>
+#include <string>
+
+/**
+ * Faster host linker for the links of clang (HIPCC_FAST_LINKER).
+ *
+ * clang links with the system linker, usually GNU ld, unless told
+ * otherwise. For commands which link and do not choose a linker themselves
+ * (-fuse-ld=, --ld-path=), ld.lld next to the compiler is used, then
+ * ld.mold next to the compiler or on PATH, then ld.lld on PATH. An ld.lld
+ * of another LLVM may not read the bitcode of the compiler, so it is not
+ * used for -flto links. HIPCC_FAST_LINKER=0 keeps the default linker, =lld
+ * or =mold chooses one. With "threads" in the comma separated setting, as
+ * in lld,threads, the linker also runs with as many threads as hipcc runs
+ * jobs.
+ */
+class HipBinFastLinker {
+ public:
+  HipBinFastLinker(const string& choice, HipBinUtil* hipBinUtilPtr);
+  string flags(const string& command, const HipCCJob& job,
+               const string& compilerPath, int maxJobs);
+  const string& linker() const;
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  string choice_;
+  string linker_;
+  bool threads_ = false;
+  static bool isInstalled(const fs::path& dir, const string& name);
+};
+
+HipBinFastLinker::HipBinFastLinker(const string& choice,
+                                   HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr) {
+  for (auto& item : hipBinUtilPtr_->splitStr(choice, ',')) {
+    if (item == "threads")
+      threads_ = true;
+    else
+      choice_ = item;
+  }
+}
+
+// true when dir has the program name
+bool HipBinFastLinker::isInstalled(const fs::path& dir, const string& name) {
+  std::error_code ec;
+  return !dir.empty() && fs::is_regular_file(dir / name, ec);
+}
+
+// the linker chosen by the last flags, empty when there is none
+const string& HipBinFastLinker::linker() const {
+  return linker_;
+}
+
+// the flags choosing the linker, empty for commands which do not link,
+// such as --version, or choose their linker
+string HipBinFastLinker::flags(const string& command, const HipCCJob& job,
+                               const string& compilerPath, int maxJobs) {
+  linker_.clear();
+  if (choice_ == "0" || job.compileOnly || job.preprocessOnly ||
+      (job.sources.empty() && job.inputs.empty()))
+    return "";
+  bool lto = false;
+  for (auto& arg : hipBinUtilPtr_->splitCmdLine(command)) {
+    // -fuse-ld= may also come with -Wl, or -Xlinker
+    if (arg.find("-fuse-ld=") != string::npos ||
+        arg.compare(0, 10, "--ld-path=") == 0)
+      return "";
+    if (arg == "-flto" || arg.compare(0, 6, "-flto=") == 0)
+      lto = true;
+    else if (arg == "-fno-lto")
+      lto = false;
+  }
+  vector<fs::path> path;
+  if (const char* pathEnv = std::getenv("PATH")) {
+    for (auto& dir : hipBinUtilPtr_->splitStr(pathEnv, ':'))
+      path.push_back(dir);
+  }
+  auto onPath = [&](const string& name) {
+    for (auto& dir : path) {
+      if (isInstalled(dir, name))
+        return true;
+    }
+    return false;
+  };
+  fs::path compilerDir = compilerPath;
+  if (choice_ == "lld" || choice_ == "mold") {
+    linker_ = choice_;
+  } else if (isInstalled(compilerDir, "ld.lld")) {
+    linker_ = "lld";
+  } else if (isInstalled(compilerDir, "ld.mold") || onPath("ld.mold")) {
+    linker_ = "mold";
+  } else if (!lto && onPath("ld.lld")) {
+    linker_ = "lld";
+  } else {
+    return "";
+  }
+  string flags = " -fuse-ld=" + linker_;
+  if (threads_)
+    flags += string(" -Wl,") + (linker_ == "mold" ? "--thread-count=" :
+             "--threads=") + std::to_string(maxJobs > 0 ? maxJobs : 1);
+  return flags;
+}
+
+#endif  // SRC_HIPBIN_LINKER_H_
@@ -44,7 +44,7 @@ class HipBinNvidia : public HipBinBase {
   virtual const PlatformInfo& getPlatformInfo() const;
   virtual string getCppConfig();
   virtual void printFull();
-  virtual void printCompilerInfo() const;
+  virtual void printCompilerInfo();
   virtual string getCompilerVersion();
   virtual void checkHipconfig();
   virtual string getDeviceLibPath() const;
@@ -157,8 +157,7 @@ void HipBinNvidia::printFull() {
   cout << endl << "== Envirnoment Variables" << endl;
   printEnvironmentVariables();
   getSystemInfo();
-  if (fs::exists("/usr/bin/lsb_release"))
-    system("/usr/bin/lsb_release -a");
+  printOsRelease();
 }
 
 // returns hip include
@@ -247,7 +246,7 @@ const string& HipBinNvidia::getCompilerPath() const {
 }
 
 // returns nvcc information
-void HipBinNvidia::printCompilerInfo() const {
+void HipBinNvidia::printCompilerInfo() {
   string cmd;
   fs::path nvcc;
   nvcc = getCompilerPath();
@@ -587,14 +586,8 @@ void HipBinNvidia::executeHipCCCmd(vector<string> argv) {
     cout << HIPLDFLAGS;
   }
   if (runCmd) {
-    SystemCmdOut sysOut;
-    sysOut = hipBinUtilPtr_->exec(CMD.c_str(), true);
-    string cmdOut = sysOut.out;
-    int CMD_EXIT_CODE = sysOut.exitCode;
-    if (CMD_EXIT_CODE !=0) {
-      cout <<  "failed to execute:"  << CMD << std::endl;
-    }
-    exit(CMD_EXIT_CODE);
+    vector<string> userArgs(argv.begin() + 1, argv.end());
+    exit(runHipCCCmd(CMD, userArgs));
   }
 }   // end of function
 
@@ -0,0 +1,249 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_PCH_H_
+#define SRC_HIPBIN_PCH_H_
+
+#include "hipBin_util.h"
+#include "hipBin_job.h"
+#include "hipBin_tasks.h"
+#include "hipBin_split.h"
+#include <chrono>
+#include <vector>
+#include <string>
+
+# define HIPCC_PCH_VERSION "hipcc-pch-1"
+# define HIPCC_PCH_RETRY_SECONDS  3600
+
+/**
+ * Precompiled HIP runtime headers (HIPCC_PCH_DIR).
+ *
+ * A precompiled header holds one target's view of the headers, so one is
+ * built for the host and one for each offload target, from a prefix which
+ * includes hip/hip_runtime.h. The -include options of the command, such as
+ * the SPIR-V fixup header, are part of it. The headers are stored as
+ * <dir>/<signature>-<target>.pch, where the signature hashes the compile
+ * flags without the source, output and dependency options, the compiler
+ * identity and the environment clang reads: platform, targets, defines,
+ * language standard and optimization level are all covered by the flags.
+ *
+ * One hipcc builds a missing set while holding <signature>.lock, the
+ * others wait for it. <signature>.ok marks a complete set; a set whose
+ * headers changed since is rebuilt. When the build fails, <signature>.failed
+ * is written and compiles with that signature run without the headers,
+ * until one of the headers the failed build read changes or an hour
+ * passed, so failures such as a full disk are retried.
+ *
+ * The compile is then split into its host and device compiles, each
+ * including its header with -include-pch.
+ * Only sources which start by including hip/hip_runtime.h use them, so
+ * the headers mean the same as they do in the source.
+ */
+class HipBinPch {
+ public:
+  HipBinPch(const string& pchDir, HipBinUtil* hipBinUtilPtr);
+  static bool usable(const vector<string>& args, const HipCCJob& job,
+                     HipBinUtil* hipBinUtilPtr);
+  HipccPchMap get(const vector<string>& args, const HipCCJob& job,
+                  const string& compilerId, HipBinTaskRunner* runner);
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  fs::path pchDir_;
+  bool isValid(const string& signature, const HipccPchMap& pchs) const;
+  bool failedRecently(const string& signature) const;
+};
+
+HipBinPch::HipBinPch(const string& pchDir, HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr), pchDir_(pchDir) {}
+
+// true for a HIP compile whose source includes hip/hip_runtime.h before
+// anything else, comments and #pragma once aside
+bool HipBinPch::usable(const vector<string>& args, const HipCCJob& job,
+                       HipBinUtil* hipBinUtilPtr) {
+  bool isHip = false;
+  for (size_t i = 0; i + 1 < args.size(); i++) {
+    if (args[i] == "-include-pch" || args[i] == "-E" ||
+        args[i].compare(0, 8, "-Xarch_") == 0)
+      return false;
+    if (args[i] == "-x")
+      isHip = args[i + 1] == "hip";
+    if (args[i + 1] == job.sources.at(0))
+      break;
+  }
+  string text;
+  if (!isHip || !hipBinUtilPtr->readFile(job.sources.at(0), text))
+    return false;
+  std::istringstream in(text);
+  string line;
+  bool comment = false;
+  while (std::getline(in, line)) {
+    line = hipBinUtilPtr->trim(line);
+    line.erase(0, line.find_first_not_of(" \t"));
+    if (comment) {
+      comment = line.find("*/") == string::npos;
+      continue;
+    }
+    if (line.empty() || line.compare(0, 2, "//") == 0 ||
+        std::regex_match(line, regex("#\\s*pragma\\s+once")))
+      continue;
+    if (line.compare(0, 2, "/*") == 0) {
+      comment = line.find("*/") == string::npos;
+      continue;
+    }
+    return std::regex_match(line, regex("#\\s*include\\s*"
+                                        "[<\"]hip/hip_runtime\\.h[>\"].*"));
+  }
+  return false;
+}
+
+// true when all headers of the set exist and none of the headers they were
+// built from changed since
+bool HipBinPch::isValid(const string& signature,
+                        const HipccPchMap& pchs) const {
+  std::error_code ec;
+  auto okTime = fs::last_write_time(pchDir_ / (signature + ".ok"), ec);
+  if (ec)
+    return false;
+  for (auto& pch : pchs) {
+    if (!fs::exists(pch.second, ec))
+      return false;
+  }
+  vector<string> deps = hipBinUtilPtr_->parseDepFile(
+                        (pchDir_ / (signature + ".d")).string());
+  if (deps.empty())
+    return false;
+  for (auto& dep : deps) {
+    auto depTime = fs::last_write_time(dep, ec);
+    if (ec || depTime > okTime)
+      return false;
+  }
+  return true;
+}
+
+// true while the last build of the set failed and is not to be retried
+// yet: none of the headers it read changed and it is less than
+// HIPCC_PCH_RETRY_SECONDS old
+bool HipBinPch::failedRecently(const string& signature) const {
+  std::error_code ec;
+  auto failedTime = fs::last_write_time(pchDir_ / (signature + ".failed"),
+                                        ec);
+  if (ec || fs::file_time_type::clock::now() - failedTime >
+      std::chrono::seconds(HIPCC_PCH_RETRY_SECONDS))
+    return false;
+  for (auto& dep : hipBinUtilPtr_->parseDepFile(
+                   (pchDir_ / (signature + ".d")).string())) {
+    auto depTime = fs::last_write_time(dep, ec);
+    if (ec || depTime > failedTime)
+      return false;
+  }
+  return true;
+}
+
+// the precompiled headers of the compile, built first when needed. Empty
+// when they can not be built.
+HipccPchMap HipBinPch::get(const vector<string>& args, const HipCCJob& job,
+                           const string& compilerId,
+                           HipBinTaskRunner* runner) {
+  vector<string> common, depArgs, flags;
+  HipBinSplitCompile::splitArgs(args, job, common, depArgs);
+  for (auto& arg : common) {
+    if (arg != "-c" && arg != job.sources.at(0))
+      flags.push_back(arg);
+  }
+  HipBinHash hash;
+  hash.update(HIPCC_PCH_VERSION).update(compilerId);
+  for (auto& arg : flags)
+    hash.update(arg);
+  for (auto& name : hipccClangEnv) {
+    const char* value = std::getenv(name.c_str());
+    hash.update(name + "=" + (value ? value : ""));
+  }
+  string signature = hash.hexDigest();
+  auto pchPath = [&](const string& target) {
+    string name = target.empty() ? "device" : target;
+    std::replace(name.begin(), name.end(), ':', '_');
+    return (pchDir_ / (signature + "-" + name + ".pch")).string();
+  };
+  vector<string> archs = HipBinSplitCompile::offloadArchs(flags);
+  if (archs.empty())
+    archs.push_back("");
+  HipccPchMap pchs = { {"host", pchPath("host")} };
+  for (auto& arch : archs)
+    pchs[arch] = pchPath(arch);
+  std::error_code ec;
+  fs::path failed = pchDir_ / (signature + ".failed");
+  if (failedRecently(signature))
+    return {};
+  if (isValid(signature, pchs))
+    return pchs;
+
+  fs::create_directories(pchDir_, ec);
+  HipBinFileLock lock((pchDir_ / (signature + ".lock")).string());
+  if (isValid(signature, pchs))
+    return pchs;
+  if (failedRecently(signature))
+    return {};
+  string prefix = (pchDir_ / (signature + ".hip")).string();
+  string depFile = (pchDir_ / (signature + ".d")).string();
+  if (!hipBinUtilPtr_->writeFileAtomic(prefix,
+                                       "#include <hip/hip_runtime.h>\n"))
+    return {};
+  auto quoteArgs = [&](const vector<string>& pchArgs) {
+    string cmd;
+    for (auto& arg : pchArgs)
+      cmd += (cmd.empty() ? "" : " ") + hipBinUtilPtr_->quoteArg(arg);
+    return cmd + " 2> /dev/null";
+  };
+  vector<string> deviceFlags;
+  for (auto& arg : flags) {
+    if (HipBinSplitCompile::offloadArchs({arg}).empty())
+      deviceFlags.push_back(arg);
+  }
+  vector<HipccTask> tasks;
+  vector<string> host = flags;
+  host.insert(host.end(), {"--cuda-host-only", "-S", "-Xclang", "-emit-pch",
+                           "-MD", "-MF", depFile, "-x", "hip", prefix, "-o",
+                           pchs["host"]});
+  tasks.push_back({quoteArgs(host), {}});
+  for (auto& arch : archs) {
+    vector<string> device = arch.empty() ? flags : deviceFlags;
+    if (!arch.empty())
+      device.push_back("--offload-arch=" + arch);
+    device.insert(device.end(), {"--cuda-device-only", "-S", "-Xclang",
+                                 "-emit-pch", "-x", "hip", prefix, "-o",
+                                 pchs[arch]});
+    tasks.push_back({quoteArgs(device), {}});
+  }
+  string out;
+  fs::remove(pchDir_ / (signature + ".ok"), ec);
+  if (runner->run(tasks, out) != 0) {
+    hipBinUtilPtr_->writeFileAtomic(failed.string(), signature + "\n");
+    return {};
+  }
+  fs::remove(failed, ec);
+  hipBinUtilPtr_->writeFileAtomic((pchDir_ / (signature + ".ok")).string(),
+                                  signature + "\n");
+  return pchs;
+}
+
+#endif  // SRC_HIPBIN_PCH_H_
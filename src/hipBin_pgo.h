@@ -0,0 +1,170 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_PGO_H_
+#define SRC_HIPBIN_PGO_H_
+
+#include "hipBin_util.h"
+#include "hipBin_job.h"
+#include <vector>
+#include <string>
+
+# define HIPCC_PGO_PROFILE  "default.profdata"
+
+/**
+ * Profile guided optimization of the host code (--hipcc-pgo).
+ *
+ * generate:<dir> instruments the host code, whose runs write raw profiles
+ * to <dir>. use:<dir> merges the raw profiles of <dir> into
+ * <dir>/default.profdata with the llvm-profdata of the compiler, when any
+ * of them is newer than it, and compiles the host code with it. The merge
+ * holds <dir>/.hipcc-pgo.lock, so the compiles of a parallel build merge
+ * once. The flags are passed with -Xarch_host for HIP compiles, which
+ * keeps them away from the device compiles.
+ *
+ * A source changed after the newest raw profile was written is reported as
+ * stale, and compiles without any profile run without -fprofile-use.
+ * HIPCC_PLAN_ONLY and --hipcc-fingerprint only compute the flags and leave
+ * the profiles as they are.
+ */
+class HipBinPgo {
+ public:
+  HipBinPgo(const string& mode, const string& dir, HipBinUtil* hipBinUtilPtr);
+  string flags(const string& command, const HipCCJob& job,
+               const string& compilerPath, bool update);
+  string profileIdentity() const;
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  string mode_;
+  fs::path dir_;
+  vector<string> rawProfiles(fs::file_time_type& newest) const;
+  bool merge(const string& compilerPath);
+};
+
+HipBinPgo::HipBinPgo(const string& mode, const string& dir,
+                     HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr), mode_(mode), dir_(dir) {}
+
+// the raw profiles in the directory and the time of the newest of them
+vector<string> HipBinPgo::rawProfiles(fs::file_time_type& newest) const {
+  vector<string> raws;
+  newest = fs::file_time_type::min();
+  std::error_code ec;
+  for (auto& entry : fs::directory_iterator(dir_, ec)) {
+    if (entry.path().extension() != ".profraw")
+      continue;
+    raws.push_back(entry.path().string());
+    std::error_code timeEc;
+    auto rawTime = fs::last_write_time(entry.path(), timeEc);
+    if (timeEc || rawTime > newest)
+      newest = timeEc ? fs::file_time_type::max() : rawTime;
+  }
+  return raws;
+}
+
+// merges the raw profiles into the profile when it is missing or older
+// than any of them. False when there is no profile.
+bool HipBinPgo::merge(const string& compilerPath) {
+  fs::path profile = dir_ / HIPCC_PGO_PROFILE;
+  auto isCurrent = [&](vector<string>& raws) {
+    std::error_code ec;
+    auto profileTime = fs::last_write_time(profile, ec);
+    fs::file_time_type newest;
+    raws = rawProfiles(newest);
+    return raws.empty() || (!ec && newest <= profileTime);
+  };
+  vector<string> raws;
+  if (isCurrent(raws))
+    return fs::exists(profile);
+  HipBinFileLock lock((dir_ / ".hipcc-pgo.lock").string());
+  if (isCurrent(raws))
+    return fs::exists(profile);
+  string tmpProfile = profile.string() + ".tmp";
+  string cmd = hipBinUtilPtr_->quoteArg((fs::path(compilerPath) /
+                                         "llvm-profdata").string()) +
+               " merge -o " + hipBinUtilPtr_->quoteArg(tmpProfile);
+  for (auto& raw : raws)
+    cmd += " " + hipBinUtilPtr_->quoteArg(raw);
+  SystemCmdOut merged = hipBinUtilPtr_->exec(cmd.c_str());
+  std::error_code ec;
+  if (merged.exitCode != 0) {
+    std::cerr << "hipcc: warning: merging the profiles in " << dir_.string()
+              << " failed" << endl;
+    fs::remove(tmpProfile, ec);
+    return fs::exists(profile);
+  }
+  fs::rename(tmpProfile, profile, ec);
+  return !ec;
+}
+
+// the flags adding the instrumentation or the profile to the command.
+// Without update the flags are only computed, for printing: the profile
+// directory is neither created nor merged into.
+string HipBinPgo::flags(const string& command, const HipCCJob& job,
+                        const string& compilerPath, bool update) {
+  vector<string> args = hipBinUtilPtr_->splitCmdLine(command);
+  bool isHip = false;
+  for (size_t i = 0; i < args.size(); i++) {
+    isHip = isHip || args[i] == "-xhip" ||
+            (args[i] == "-x" && i + 1 < args.size() && args[i + 1] == "hip");
+  }
+  string prefix = isHip ? " -Xarch_host " : " ";
+  std::error_code ec;
+  if (mode_ == "generate") {
+    if (update)
+      fs::create_directories(dir_, ec);
+    return prefix + hipBinUtilPtr_->quoteArg("-fprofile-generate=" +
+                                             dir_.string());
+  }
+  if (job.sources.empty())
+    return "";
+  fs::path profile = dir_ / HIPCC_PGO_PROFILE;
+  if (update ? !merge(compilerPath) : !fs::exists(profile)) {
+    std::cerr << "hipcc: warning: no profile in " << dir_.string()
+              << ", compiling without it" << endl;
+    return "";
+  }
+  // the profile was collected when the newest raw profile was written, or
+  // when it was made if it comes without them
+  fs::file_time_type collected;
+  if (rawProfiles(collected).empty())
+    collected = fs::last_write_time(profile, ec);
+  for (auto& source : job.sources) {
+    auto sourceTime = fs::last_write_time(source, ec);
+    if (!ec && sourceTime > collected)
+      std::cerr << "hipcc: warning: " << source << " changed after the "
+                << "profile in " << dir_.string() << " was collected, "
+                << "the profile may be stale" << endl;
+  }
+  return prefix + hipBinUtilPtr_->quoteArg("-fprofile-use=" +
+                                           profile.string());
+}
+
+// identifies the contents of the profile used, for cache keys
+string HipBinPgo::profileIdentity() const {
+  if (mode_ != "use")
+    return "";
+  return hipBinUtilPtr_->hashFile((dir_ / HIPCC_PGO_PROFILE).string());
+}
+
+#endif  // SRC_HIPBIN_PGO_H_
@@ -0,0 +1,246 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_PLAN_H_
+#define SRC_HIPBIN_PLAN_H_
+
+#include "hipBin_util.h"
+#include "hipBin_job.h"
+#include "hipBin_tasks.h"
+#include <utility>
+#include <vector>
+#include <string>
+
+# define HIPCC_PLAN_VERSION "hipcc-plan-2"
+
+// names of a compile which change from one invocation to the next, as
+// {placeholder, value} pairs
+typedef vector<std::pair<string, string>> HipccPlanNames;
+
+/**
+ * Driver job plans for direct -cc1 invocation (HIPCC_DIRECT_CC1).
+ *
+ * The jobs the clang driver would run for a compile (cc1 for host and
+ * each device, lld, clang-offload-bundler, ...) are captured once with
+ * -### and stored in <dir>/<signature>.plan with placeholders for the
+ * source, output, dependency file and temporary files. The signature
+ * covers the command with those names masked, the compiler identity, the
+ * working directory and the environment the driver reads, so compiles with
+ * the same flags share one plan. The jobs are then run directly, the
+ * independent ones in parallel, without starting the driver.
+ *
+ * The -cuid the driver derived for the captured source is replaced by a
+ * placeholder too, and recomputed from the source path and the plan
+ * signature when the plan is bound, so that each translation unit keeps its
+ * own compilation unit ID (static and __device__ symbols of -fgpu-rdc
+ * objects are made unique with it). An explicit -cuid of the command is
+ * kept as it is.
+ *
+ * Plan file: HIPCC_PLAN_VERSION, then one job per line as tab separated,
+ * escaped arguments.
+ */
+class HipBinPlan {
+ public:
+  HipBinPlan(const string& planDir, HipBinUtil* hipBinUtilPtr);
+  bool load(const string& cmdline, const HipccPlanNames& names,
+            const string& compilerId);
+  vector<HipccTask> bind(const HipccPlanNames& names, const string& tmpDir,
+                         const string& redirect) const;
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  fs::path planDir_;
+  string signature_;
+  vector<vector<string>> jobs_;
+  string generalize(const string& arg, const HipccPlanNames& names) const;
+  bool capture(const string& cmdline, const HipccPlanNames& names);
+};
+
+HipBinPlan::HipBinPlan(const string& planDir, HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr), planDir_(planDir) {}
+
+// replaces a name of the compile with its placeholder, both as a whole
+// argument and as the value of a "-option=value" argument
+string HipBinPlan::generalize(const string& arg,
+                              const HipccPlanNames& names) const {
+  for (auto& name : names) {
+    const string& value = name.second;
+    if (value.empty())
+      continue;
+    if (arg == value)
+      return name.first;
+    size_t eq = arg.size() - value.size() - 1;
+    if (arg.size() > value.size() + 1 && arg[eq] == '=' &&
+        arg.compare(eq + 1, string::npos, value) == 0)
+      return arg.substr(0, eq + 1) + name.first;
+  }
+  return arg;
+}
+
+// reads the plan for the command, capturing it first if there is none yet
+bool HipBinPlan::load(const string& cmdline, const HipccPlanNames& names,
+                      const string& compilerId) {
+  HipBinHash hash;
+  hash.update(HIPCC_PLAN_VERSION).update(compilerId);
+  hash.update(fs::current_path().string());
+  for (auto& arg : hipBinUtilPtr_->splitCmdLine(cmdline))
+    hash.update(generalize(arg, names));
+  for (auto& name : names)
+    hash.update(fs::path(name.second).extension().string());
+  for (auto& name : hipccClangEnv) {
+    const char* value = std::getenv(name.c_str());
+    hash.update(name + "=" + (value ? value : ""));
+  }
+  signature_ = hash.hexDigest();
+  fs::path planPath = planDir_ / (signature_ + ".plan");
+
+  string plan;
+  if (hipBinUtilPtr_->readFile(planPath.string(), plan)) {
+    std::istringstream in(plan);
+    string line;
+    if (std::getline(in, line) && line == HIPCC_PLAN_VERSION) {
+      while (std::getline(in, line)) {
+        jobs_.push_back({});
+        for (auto& arg : hipBinUtilPtr_->splitStr(line, '\t'))
+          jobs_.back().push_back(hipBinUtilPtr_->unescapeField(arg));
+      }
+      return !jobs_.empty();
+    }
+  }
+  if (!capture(cmdline, names))
+    return false;
+  plan = string(HIPCC_PLAN_VERSION) + "\n";
+  for (auto& job : jobs_) {
+    for (size_t i = 0; i < job.size(); i++)
+      plan += (i ? "\t" : "") + hipBinUtilPtr_->escapeField(job[i]);
+    plan += "\n";
+  }
+  std::error_code ec;
+  fs::create_directories(planDir_, ec);
+  hipBinUtilPtr_->writeFileAtomic(planPath.string(), plan);
+  return true;
+}
+
+// runs the driver with -### and a private TMPDIR, so that the temporary
+// files of the plan are recognized by their directory
+bool HipBinPlan::capture(const string& cmdline, const HipccPlanNames& names) {
+  string tmpDir = hipBinUtilPtr_->mkdtempDir(
+                  (fs::path(hipBinUtilPtr_->getTempDir()) /
+                   "hipccplanXXXXXX").string());
+  if (tmpDir.empty())
+    return false;
+  SystemCmdOut sysOut = hipBinUtilPtr_->exec(
+      ("TMPDIR=" + hipBinUtilPtr_->quoteArg(tmpDir) + " " + cmdline +
+       " -### 2>&1").c_str());
+  std::error_code ec;
+  fs::remove_all(tmpDir, ec);
+  if (sysOut.exitCode != 0)
+    return false;
+  bool explicitCuid = false;
+  for (auto& arg : hipBinUtilPtr_->splitCmdLine(cmdline))
+    explicitCuid = explicitCuid || arg.compare(0, 6, "-cuid=") == 0;
+
+  // job lines look like:  "/path/clang-17" "-cc1" "-triple" ...
+  std::istringstream in(sysOut.out);
+  string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 2, " \"") != 0)
+      continue;
+    vector<string> job;
+    for (size_t i = 1; i < line.size(); i++) {
+      if (line[i] != '"')
+        continue;
+      string arg;
+      for (i++; i < line.size() && line[i] != '"'; i++) {
+        if (line[i] == '\\' && i + 1 < line.size())
+          i++;
+        arg += line[i];
+      }
+      arg = hipBinUtilPtr_->replaceAllStr(arg, tmpDir, "@TMPDIR@");
+      bool mainFileName = !job.empty() && job.back() == "-main-file-name";
+      if (mainFileName)
+        job.push_back("@SRCNAME@");
+      else if (!explicitCuid && arg.compare(0, 6, "-cuid=") == 0)
+        job.push_back("-cuid=@CUID@");
+      else
+        job.push_back(generalize(arg, names));
+    }
+    if (!job.empty())
+      jobs_.push_back(job);
+  }
+  return !jobs_.empty();
+}
+
+// the plan's jobs for this compile. Temporary files go to tmpDir, the
+// redirect is appended to each command. A job depends on the earlier jobs
+// whose output it reads.
+vector<HipccTask> HipBinPlan::bind(const HipccPlanNames& names,
+                                   const string& tmpDir,
+                                   const string& redirect) const {
+  HipccPlanNames values = names;
+  values.push_back({"@TMPDIR@", tmpDir});
+  HipBinHash cuid;
+  cuid.update(signature_);
+  for (auto& name : names) {
+    if (name.first != "@SRC@")
+      continue;
+    values.push_back({"@SRCNAME@", fs::path(name.second).filename().string()});
+    std::error_code ec;
+    cuid.update(fs::absolute(name.second, ec).string());
+  }
+  values.push_back({"@CUID@", cuid.hexDigest()});
+  vector<HipccTask> tasks;
+  vector<vector<string>> outputs;
+  for (auto& job : jobs_) {
+    HipccTask task;
+    vector<string> args, jobOutputs;
+    for (auto& arg : job) {
+      string bound = arg;
+      for (auto& value : values)
+        bound = hipBinUtilPtr_->replaceAllStr(bound, value.first, value.second);
+      if (!args.empty() && args.back() == "-o")
+        jobOutputs.push_back(bound);
+      else if (bound.compare(0, 8, "-output=") == 0)
+        jobOutputs.push_back(bound.substr(8));
+      args.push_back(bound);
+      task.cmd += (task.cmd.empty() ? "" : " ") +
+                  hipBinUtilPtr_->quoteArg(bound);
+    }
+    for (size_t i = 0; i < tasks.size(); i++) {
+      bool reads = false;
+      for (auto& output : outputs[i]) {
+        for (auto& arg : args)
+          reads = reads || (arg.find(output) != string::npos &&
+                            std::find(jobOutputs.begin(), jobOutputs.end(),
+                                      arg) == jobOutputs.end());
+      }
+      if (reads)
+        task.deps.push_back(i);
+    }
+    task.cmd += redirect;
+    tasks.push_back(task);
+    outputs.push_back(jobOutputs);
+  }
+  return tasks;
+}
+
+#endif  // SRC_HIPBIN_PLAN_H_
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_PREFETCH_H_
+#define SRC_HIPBIN_PREFETCH_H_
+
+#include "hipBin_util.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+
+# define HIPCC_PREFETCH_THREADS  4
+
+/**
+ * Warms the page cache with the headers a compile is expected to read
+ * (HIPCC_PREFETCH_DIR), while hipcc and clang start up. Files are handed
+ * to the kernel with posix_fadvise(WILLNEED) and readahead from a few
+ * threads, so reads from slow or network storage overlap. Prefetching is
+ * only a hint: it stops when the object is destroyed and errors are
+ * ignored. It does nothing on Windows.
+ */
+class HipBinPrefetcher {
+ public:
+  HipBinPrefetcher() {}
+  ~HipBinPrefetcher();
+  void start(const vector<string>& files);
+
+ private:
+  vector<string> files_;
+  std::atomic<size_t> next_{0};
+  std::atomic<bool> stop_{false};
+  vector<std::thread> threads_;
+  void run();
+};
+
+void HipBinPrefetcher::start(const vector<string>& files) {
+#if !defined(_WIN32) && !defined(_WIN64)
+  files_ = files;
+  size_t numThreads = std::min<size_t>(HIPCC_PREFETCH_THREADS, files_.size());
+  for (size_t i = 0; i < numThreads; i++)
+    threads_.emplace_back(&HipBinPrefetcher::run, this);
+#endif
+}
+
+HipBinPrefetcher::~HipBinPrefetcher() {
+  stop_ = true;
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+void HipBinPrefetcher::run() {
+#if !defined(_WIN32) && !defined(_WIN64)
+  size_t i;
+  while (!stop_ && (i = next_++) < files_.size()) {
+    int fd = open(files_[i].c_str(), O_RDONLY);
+    if (fd < 0)
+      continue;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#if defined(__linux__)
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+      readahead(fd, 0, st.st_size);
+#endif
+    close(fd);
+  }
+#endif
+}
+
+#endif  // SRC_HIPBIN_PREFETCH_H_
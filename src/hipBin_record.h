@@ -0,0 +1,193 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_RECORD_H_
+#define SRC_HIPBIN_RECORD_H_
+
+#include "hipBin_base.h"
+#include "hipBin_util.h"
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <utility>
+#include <vector>
+#include <string>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#endif
+
+// Record file format, one invocation per line:
+//   hipcc1 <TAB> cwd <TAB> N <TAB> NAME=value (N times) <TAB> argv...
+// Tabs, newlines and backslashes inside fields are backslash escaped
+// (HipBinUtil::escapeField).
+# define HIPCC_RECORD_TAG "hipcc1"
+
+// A single recorded hipcc invocation
+struct HipccRecord {
+  string cwd;
+  vector<std::pair<string, string>> env;
+  vector<string> argv;
+};
+
+class HipBinRecorder {
+ public:
+  explicit HipBinRecorder(HipBinUtil* hipBinUtilPtr);
+  void record(const string& logFile, const vector<string>& argv,
+              const vector<std::pair<string, string>>& env) const;
+  vector<HipccRecord> readLog(const string& logFile) const;
+  int replay(const string& logFile, bool fullMode,
+             const vector<string>& envNames) const;
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+};
+
+HipBinRecorder::HipBinRecorder(HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr) {}
+
+// appends the invocation to the record file. Only set variables are
+// written. The line goes out in a single append so that concurrent hipcc
+// processes of a parallel build do not interleave their records.
+void HipBinRecorder::record(const string& logFile, const vector<string>& argv,
+                            const vector<std::pair<string, string>>& env)
+                            const {
+  vector<std::pair<string, string>> setVars;
+  for (auto& var : env) {
+    if (!var.second.empty())
+      setVars.push_back(var);
+  }
+  string line = HIPCC_RECORD_TAG;
+  line += "\t" + hipBinUtilPtr_->escapeField(fs::current_path().string());
+  line += "\t" + std::to_string(setVars.size());
+  for (auto& var : setVars)
+    line += "\t" + hipBinUtilPtr_->escapeField(var.first + "=" + var.second);
+  for (auto& arg : argv)
+    line += "\t" + hipBinUtilPtr_->escapeField(arg);
+  line += "\n";
+
+  bool written = false;
+#if defined(_WIN32) || defined(_WIN64)
+  ofstream out(logFile, std::ios::app | std::ios::binary);
+  if (out.is_open()) {
+    out << line;
+    written = out.good();
+  }
+#else
+  int fd = open(logFile.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd >= 0) {
+    written = write(fd, line.data(), line.size()) ==
+              static_cast<ssize_t>(line.size());
+    close(fd);
+  }
+#endif
+  if (!written)
+    std::cerr << "Warning: unable to write the hipcc record file "
+              << logFile << endl;
+}
+
+// reads all invocations from the record file, malformed lines are skipped
+vector<HipccRecord> HipBinRecorder::readLog(const string& logFile) const {
+  vector<HipccRecord> records;
+  ifstream in(logFile);
+  string line;
+  while (std::getline(in, line)) {
+    vector<string> fields = hipBinUtilPtr_->splitStr(line, '\t');
+    if (fields.size() < 4 || fields.at(0) != HIPCC_RECORD_TAG)
+      continue;
+    HipccRecord record;
+    record.cwd = hipBinUtilPtr_->unescapeField(fields.at(1));
+    size_t numEnv = std::strtoul(fields.at(2).c_str(), nullptr, 10);
+    if (fields.size() < 3 + numEnv + 1)
+      continue;
+    for (size_t i = 0; i < numEnv; i++) {
+      string var = hipBinUtilPtr_->unescapeField(fields.at(3 + i));
+      size_t eq = var.find('=');
+      if (eq != string::npos)
+        record.env.push_back({var.substr(0, eq), var.substr(eq + 1)});
+    }
+    for (size_t i = 3 + numEnv; i < fields.size(); i++)
+      record.argv.push_back(hipBinUtilPtr_->unescapeField(fields.at(i)));
+    records.push_back(record);
+  }
+  return records;
+}
+
+// re-runs every recorded invocation with the running hipcc binary and
+// reports the wall time of each. In plan mode the children only construct
+// their command (HIPCC_PLAN_ONLY=1), which isolates startup and argument
+// processing from the compiler itself.
+int HipBinRecorder::replay(const string& logFile, bool fullMode,
+                           const vector<string>& envNames) const {
+  vector<HipccRecord> records = readLog(logFile);
+  if (records.empty()) {
+    cout << "No hipcc invocations found in " << logFile << endl;
+    return -1;
+  }
+  string self = hipBinUtilPtr_->quoteArg(hipBinUtilPtr_->getSelfExe());
+  const char* mode = fullMode ? "full" : "plan";
+  double totalMs = 0;
+  int failed = 0;
+  for (size_t r = 0; r < records.size(); r++) {
+    const HipccRecord& record = records.at(r);
+    for (auto& name : envNames)
+      hipBinUtilPtr_->setEnv(name, "");
+    for (auto& var : record.env)
+      hipBinUtilPtr_->setEnv(var.first, var.second);
+    hipBinUtilPtr_->setEnv(HIPCC_RECORD, "");
+    hipBinUtilPtr_->setEnv(HIPCC_PLAN_ONLY, fullMode ? "" : "1");
+    try {
+      fs::current_path(record.cwd);
+    } catch (...) {
+      cout << "replay " << r + 1 << "/" << records.size()
+           << " skipped, missing directory " << record.cwd << endl;
+      failed++;
+      continue;
+    }
+
+    string cmd = self;
+    string shown = "hipcc";
+    for (size_t i = 1; i < record.argv.size(); i++) {
+      cmd += " " + hipBinUtilPtr_->quoteArg(record.argv.at(i));
+      shown += " " + record.argv.at(i);
+    }
+    cmd += " 2>&1";
+    auto start = std::chrono::steady_clock::now();
+    SystemCmdOut sysOut = hipBinUtilPtr_->exec(cmd.c_str());
+    auto stop = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(stop - start).count();
+    totalMs += ms;
+    cout << "replay " << r + 1 << "/" << records.size() << " " << mode << " "
+         << std::fixed << std::setprecision(2) << ms << " ms exit "
+         << sysOut.exitCode << " " << shown << endl;
+    if (sysOut.exitCode != 0) {
+      failed++;
+      cout << sysOut.out;
+    }
+  }
+  cout << "replayed " << records.size() << " invocations in " << std::fixed
+       << std::setprecision(2) << totalMs << " ms (mean "
+       << totalMs / records.size() << " ms), " << failed << " failed" << endl;
+  return failed == 0 ? 0 : 1;
+}
+
+#endif  // SRC_HIPBIN_RECORD_H_
@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_SCAN_H_
+#define SRC_HIPBIN_SCAN_H_
+
+#include "hipBin_util.h"
+#include <set>
+#include <vector>
+#include <string>
+
+# define HIPCC_SCAN_VERSION "hipcc-scan-2"
+
+/**
+ * Detection of HIP sources without device code (HIPCC_SCAN_DIR), which
+ * are then compiled for the host only.
+ *
+ * The source and the headers listed in its previous dependency file are
+ * searched for the markers of device code: kernel and device function
+ * qualifiers, device variables and kernel launches. The HIP runtime and
+ * clang wrapper headers, which always have them, are not searched. Every
+ * #include of a searched file has to be in the dependency file, so a
+ * header added since the last compile makes the source count as device
+ * code. The result for each file is cached in the directory by the hash of
+ * its contents, with its #include names, so an edit which keeps the size
+ * and modification time of a file is still seen.
+ */
+class HipBinDeviceScan {
+ public:
+  HipBinDeviceScan(const string& scanDir, HipBinUtil* hipBinUtilPtr);
+  bool isDeviceFree(const string& source, const vector<string>& deps);
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  fs::path scanDir_;
+  bool scan(const string& file, bool& hasDevice, vector<string>& includes);
+  static bool isRuntimeHeader(const string& file);
+};
+
+HipBinDeviceScan::HipBinDeviceScan(const string& scanDir,
+                                   HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr), scanDir_(scanDir) {}
+
+// headers of the HIP runtime and of clang
+bool HipBinDeviceScan::isRuntimeHeader(const string& file) {
+  static const regex runtimeDirs("(^|[/\\\\])(include[/\\\\]hip|"
+                                 "lib(64)?[/\\\\]clang)[/\\\\]");
+  return std::regex_search(file, runtimeDirs);
+}
+
+// looks for device code in the file and lists its #include names
+bool HipBinDeviceScan::scan(const string& file, bool& hasDevice,
+                            vector<string>& includes) {
+  static const vector<string> markers = {
+    "__global__", "__device__", "__constant__", "__shared__", "__managed__",
+    "__launch_bounds__", "<<<", "hipLaunchKernelGGL" };
+  HipBinHash hash;
+  string contentHash = hipBinUtilPtr_->hashFile(file);
+  if (contentHash.empty())
+    return false;
+  hash.update(HIPCC_SCAN_VERSION).update(contentHash);
+  fs::path entryPath = scanDir_ / (hash.hexDigest() + ".scan");
+  string entry;
+  if (hipBinUtilPtr_->readFile(entryPath.string(), entry)) {
+    vector<string> lines = hipBinUtilPtr_->splitStr(entry, '\n');
+    if (!lines.empty() && (lines[0] == "device" || lines[0] == "host")) {
+      hasDevice = lines[0] == "device";
+      for (size_t i = 1; i < lines.size(); i++) {
+        if (!lines[i].empty())
+          includes.push_back(lines[i]);
+      }
+      return true;
+    }
+  }
+
+  string text;
+  if (!hipBinUtilPtr_->readFile(file, text))
+    return false;
+  // string::find looks for the first character with memchr
+  hasDevice = false;
+  for (auto& marker : markers)
+    hasDevice = hasDevice || text.find(marker) != string::npos;
+  static const regex includeLine("^[ \\t]*#[ \\t]*include[ \\t]*"
+                                 "[<\"]([^>\"]+)[>\"]");
+  for (size_t pos = text.find("include"); pos != string::npos;
+       pos = text.find("include", pos + 7)) {
+    size_t lineStart = text.rfind('\n', pos);
+    lineStart = lineStart == string::npos ? 0 : lineStart + 1;
+    size_t lineEnd = text.find('\n', pos);
+    string line = text.substr(lineStart, lineEnd == string::npos ?
+                              string::npos : lineEnd - lineStart);
+    std::smatch match;
+    if (std::regex_search(line, match, includeLine) &&
+        std::find(includes.begin(), includes.end(), match[1].str()) ==
+        includes.end())
+      includes.push_back(match[1]);
+  }
+
+  entry = hasDevice ? "device" : "host";
+  for (auto& include : includes)
+    entry += "\n" + include;
+  std::error_code ec;
+  fs::create_directories(scanDir_, ec);
+  hipBinUtilPtr_->writeFileAtomic(entryPath.string(), entry + "\n");
+  return true;
+}
+
+// true when neither the source nor its headers have device code
+bool HipBinDeviceScan::isDeviceFree(const string& source,
+                                    const vector<string>& deps) {
+  std::set<string> depNames;
+  for (auto& dep : deps)
+    depNames.insert(fs::path(dep).filename().string());
+  vector<string> files = { source };
+  for (auto& dep : deps) {
+    if (!isRuntimeHeader(dep) && dep != source)
+      files.push_back(dep);
+  }
+  for (auto& file : files) {
+    bool hasDevice;
+    vector<string> includes;
+    if (!scan(file, hasDevice, includes) || hasDevice)
+      return false;
+    for (auto& include : includes) {
+      if (!depNames.count(fs::path(include).filename().string()))
+        return false;
+    }
+  }
+  return true;
+}
+
+#endif  // SRC_HIPBIN_SCAN_H_
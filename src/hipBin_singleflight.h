@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_SINGLEFLIGHT_H_
+#define SRC_HIPBIN_SINGLEFLIGHT_H_
+
+#include "hipBin_util.h"
+#include "hipBin_cache.h"
+#include <chrono>
+#include <memory>
+#include <string>
+
+# define HIPCC_SINGLE_FLIGHT_MAX_AGE  std::chrono::minutes(10)
+
+/**
+ * Single-flight deduplication of identical concurrent compiles
+ * (HIPCC_SINGLE_FLIGHT_DIR).
+ *
+ * The first hipcc to take the lock <dir>/<key>.lock compiles and publishes
+ * its result as <dir>/<key>.done. Identical invocations started meanwhile
+ * block on the lock and copy the published result instead of compiling.
+ * The lock is an flock, so it is released when the leader exits for any
+ * reason; a waiter which finds no result published after it started waiting
+ * compiles on its own.
+ */
+class HipBinSingleFlight {
+ public:
+  HipBinSingleFlight(const string& dir, const string& key,
+                     HipBinUtil* hipBinUtilPtr);
+  bool join(HipCCResult& result);
+  void publish(const HipCCResult& result);
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  fs::path lockPath_, donePath_;
+  std::unique_ptr<HipBinFileLock> lock_;
+  void removeStale(const fs::path& dir) const;
+};
+
+HipBinSingleFlight::HipBinSingleFlight(const string& dir, const string& key,
+                                       HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr) {
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  lockPath_ = fs::path(dir) / (key + ".lock");
+  donePath_ = fs::path(dir) / (key + ".done");
+}
+
+// returns true with the result of an identical compile which was running
+// when this one started. Returns false when this process has to compile, it
+// then holds the lock until it is destroyed.
+bool HipBinSingleFlight::join(HipCCResult& result) {
+  auto start = fs::file_time_type::clock::now();
+  lock_.reset(new HipBinFileLock(lockPath_.string(), false));
+  if (lock_->locked())
+    return false;
+  // someone else is compiling, wait for it to finish
+  lock_.reset(new HipBinFileLock(lockPath_.string(), true));
+  std::error_code ec;
+  auto doneTime = fs::last_write_time(donePath_, ec);
+  string packed;
+  if (!ec && doneTime >= start - std::chrono::seconds(1) &&
+      hipBinUtilPtr_->readFile(donePath_.string(), packed) &&
+      HipBinCache::unpackResult(packed, result)) {
+    lock_.reset();
+    return true;
+  }
+  return false;
+}
+
+// makes the result available to the waiting invocations
+void HipBinSingleFlight::publish(const HipCCResult& result) {
+  hipBinUtilPtr_->writeFileAtomic(donePath_.string(),
+                                  HipBinCache::packResult(result));
+  removeStale(donePath_.parent_path());
+}
+
+// results are only useful to compiles which ran at the same time, so old
+// ones are removed by the next leader, together with lock files nobody holds
+void HipBinSingleFlight::removeStale(const fs::path& dir) const {
+  auto oldest = fs::file_time_type::clock::now() - HIPCC_SINGLE_FLIGHT_MAX_AGE;
+  std::error_code ec;
+  for (auto& entry : fs::directory_iterator(dir, ec)) {
+    string ext = entry.path().extension().string();
+    if (entry.path() == lockPath_ || (ext != ".done" && ext != ".lock"))
+      continue;
+    auto mtime = fs::last_write_time(entry.path(), ec);
+    if (ec || mtime >= oldest)
+      continue;
+    if (ext == ".lock") {
+      HipBinFileLock unused(entry.path().string(), false);
+      if (!unused.locked())
+        continue;
+    }
+    fs::remove(entry.path(), ec);
+  }
+}
+
+#endif  // SRC_HIPBIN_SINGLEFLIGHT_H_
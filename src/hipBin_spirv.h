@@ -357,7 +357,7 @@ public:
   virtual const PlatformInfo &getPlatformInfo() const;
   virtual string getCppConfig();
   virtual void printFull();
-  virtual void printCompilerInfo() const;
+  virtual void printCompilerInfo();
   virtual string getCompilerVersion();
   virtual void checkHipconfig();
   virtual string getDeviceLibPath() const;
@@ -477,15 +477,13 @@ void HipBinSpirv::constructCompilerPath() {
 // returns clang path.
 const string &HipBinSpirv::getCompilerPath() const { return hipClangPath_; }
 
-void HipBinSpirv::printCompilerInfo() const {
+void HipBinSpirv::printCompilerInfo() {
   const string &hipClangPath = getCompilerPath();
 
   cout << endl;
 
-  string cmd = hipClangPath + "/clang++ --version";
-  system(cmd.c_str()); // hipclang version
-  cmd = hipClangPath + "/llc --version";
-  system(cmd.c_str()); // llc version
+  cout << runProbe(hipClangPath + "/clang++ --version 2>&1").out;
+  cout << runProbe(hipClangPath + "/llc --version 2>&1").out;
   cout << "hip-clang-cxxflags :" << endl;
   cout << hipInfo_.cxxflags << endl;
 
@@ -651,6 +649,9 @@ void HipBinSpirv::checkHipconfig() {
 }
 
 void HipBinSpirv::printFull() {
+  const string &clangPath = getCompilerPath();
+  startProbes({clangPath + "/clang++ --version 2>&1",
+               clangPath + "/llc --version 2>&1"});
   const string &hipVersion = getHipVersion();
   const string &hipPath = getHipPath();
   const PlatformInfo &platformInfo = getPlatformInfo();
@@ -675,8 +676,7 @@ void HipBinSpirv::printFull() {
   cout << endl << "== Envirnoment Variables" << endl;
   printEnvironmentVariables();
   getSystemInfo();
-  if (fs::exists("/usr/bin/lsb_release"))
-    system("/usr/bin/lsb_release -a");
+  printOsRelease();
   cout << endl;
 }
 
@@ -757,6 +757,10 @@ void HipBinSpirv::executeHipCCCmd(vector<string> argv) {
   HIPCFLAGS = getHipCFlags();
   HIPCXXFLAGS = getHipCXXFlags();
   HIPLDFLAGS = getHipLdFlags();
+  // location independent outputs (HIPCC_BASE_DIR)
+  string prefixMapFlags = getPrefixMapFlags({getHipPath()});
+  HIPCXXFLAGS = normalizeIncludePaths(HIPCXXFLAGS) + prefixMapFlags;
+  HIPCFLAGS = normalizeIncludePaths(HIPCFLAGS) + prefixMapFlags;
   if (!var.hipccCompileFlagsAppendEnv_.empty()) {
     HIPCXXFLAGS += " " + var.hipccCompileFlagsAppendEnv_ + " ";
     HIPCFLAGS += " " + var.hipccCompileFlagsAppendEnv_ + " ";
@@ -821,11 +825,11 @@ void HipBinSpirv::executeHipCCCmd(vector<string> argv) {
   }
 
   if (!fixupHeader_.empty()) {
-    CMD += " " + fixupHeader_;
+    CMD += " " + normalizeIncludePaths(fixupHeader_);
   }
 
   // always add HIP include path for hip_runtime_api.h
-  CMD += " -I/" + hipIncludePath;
+  CMD += normalizeIncludePaths(" -I/" + hipIncludePath);
 
   // append all user provided arguments that weren't handled
   for (auto arg : processedArgs)
@@ -888,14 +892,9 @@ void HipBinSpirv::executeHipCCCmd(vector<string> argv) {
   }
 
   if (opts.runCmd.present) {
-    SystemCmdOut sysOut;
-    sysOut = hipBinUtilPtr_->exec(CMD.c_str(), true);
-    string cmdOut = sysOut.out;
-    int CMD_EXIT_CODE = sysOut.exitCode;
-    if (CMD_EXIT_CODE != 0) {
-      cout << "failed to execute:" << CMD << std::endl;
-    }
-    exit(CMD_EXIT_CODE);
+    int exitCode = runHipCCCmd(CMD, argv);
+    if (!getHipccOptions().commandOnly)
+      exit(exitCode);
   } // end of runCmd section
 } // end of function
 
@@ -0,0 +1,634 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_SPLIT_H_
+#define SRC_HIPBIN_SPLIT_H_
+
+#include "hipBin_util.h"
+#include "hipBin_job.h"
+#include "hipBin_tasks.h"
+#include <vector>
+#include <string>
+
+# define HIPCC_DEVICE_OBJECT_VERSION "hipcc-device-1"
+# define HIPCC_SPIRV_OPT_VERSION     "hipcc-spirv-opt-1"
+
+// precompiled header of each compile, keyed by offload target, "" for the
+// default device target and "host" for the host compile
+typedef map<string, string> HipccPchMap;
+
+/**
+ * Compiles split into concurrent clang invocations (HIPCC_SPLIT_COMPILE):
+ * one --cuda-device-only compile per --offload-arch and a --cuda-host-only
+ * compile, combined with clang-offload-bundler into the object clang would
+ * have produced. Device code generation for each target then runs on its
+ * own core, and only one target's code is in memory per process.
+ *
+ * clang derives the compilation unit id from each command line, which
+ * differs between the host and device compiles, and names static device
+ * variables and kernels after it. All compiles therefore get one explicit
+ * -cuid, which hashes the source and the arguments without the targets,
+ * unless the command gives its own -cuid= or -fuse-cuid=none.
+ *
+ * Each device compile writes a device-only bundle. Its entries, including
+ * the empty host entry which names the host triple, are listed and
+ * unbundled. With -fgpu-rdc the host compile runs alongside the device
+ * compiles and the device entries are bundled with the host object. Without
+ * it the host object embeds the device code, so the entries are bundled
+ * into one fat binary first, which the host compile includes with
+ * -fcuda-include-gpubinary.
+ *
+ * With a device object directory (HIPCC_DEVICE_REUSE) the device bundle of
+ * each target is kept there as <key>-<target>.o with its dependency file,
+ * where the key hashes the device command without the target list. A
+ * bundle which is newer than its dependencies and the compiler is reused,
+ * so a change of the target list only compiles the added targets.
+ *
+ * With shared preprocessing (HIPCC_SHARED_PREPROCESS) the source is
+ * preprocessed once with -frewrite-includes, which inlines the headers but
+ * keeps macros and conditionals, so the result means the same for the host
+ * and every target. It is held in a memfd and the compiles read it through
+ * /proc/<pid>/fd/<fd>, instead of each reading the headers again. This
+ * preprocessing writes the dependency file. Kept device objects and
+ * compiles with precompiled headers use the source itself.
+ *
+ * Device compiles of other platforms (--hipcc-platforms) are added with
+ * their own commands. Their device bundles are combined with those of the
+ * platform which compiles the host code, into one object for all of them.
+ *
+ * With a native compiler for SPIR-V (HIPCC_SPIRV_AOT_TOOL) the SPIR-V
+ * entries of a compile without -fgpu-rdc are also compiled ahead of time
+ * for each listed device, and the native binaries are bundled next to the
+ * SPIR-V as hip-spir64_gen-unknown-unknown--<device> entries, which the
+ * runtime can load instead of compiling the SPIR-V when it starts.
+ *
+ * With a SPIR-V optimizer (HIPCC_SPIRV_OPT) the SPIR-V entries are first
+ * run through it, one task per module, and bundled optimized. Optimized
+ * modules are kept in a directory (HIPCC_SPIRV_OPT_DIR) as <hash>.spv,
+ * where the hash covers the module and the optimizer command.
+ */
+class HipBinSplitCompile {
+ public:
+  HipBinSplitCompile(const string& bundler, const string& tmpDir,
+                     HipBinUtil* hipBinUtilPtr);
+  ~HipBinSplitCompile();
+  static bool isRdc(const vector<string>& args);
+  static vector<string> offloadArchs(const vector<string>& args);
+  static bool applies(const vector<string>& args);
+  static string compilationUnitId(const vector<string>& args,
+                                  const vector<string>& common,
+                                  const HipCCJob& job);
+  static void splitArgs(const vector<string>& args, const HipCCJob& job,
+                        vector<string>& common, vector<string>& depArgs);
+  void setPrecompiledHeaders(const HipccPchMap& pchs) { pchs_ = pchs; }
+  void prepare(const string& cmdline, const HipCCJob& job,
+               const string& depFile, const string& redirect);
+  void setDeviceObjectDir(const string& dir) { deviceObjectDir_ = dir; }
+  void sharePreprocessedSource();
+  void addDeviceCompile(const string& cmdline, const HipCCJob& job);
+  void setNativeCompile(const string& tool, const vector<string>& devices);
+  void setSpirvOptimizer(const string& optimizer, const string& cacheDir);
+  int run(HipBinTaskRunner* runner, const string& output, bool verbose,
+          string& out);
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  string bundler_, tmpDir_, deviceObjectDir_, redirect_, hostObject_;
+  string sharedSource_, cuid_;
+  int sharedFd_ = -1;
+  bool rdc_ = false;
+  vector<HipccTask> deviceTasks_;
+  HipccTask hostTask_, preprocessTask_;
+  vector<string> deviceBundles_, compiledBundles_;
+  HipccPchMap pchs_;
+  string nativeTool_, spirvOptimizer_, spirvCacheDir_;
+  vector<string> nativeDevices_;
+  string quoteArgs(const vector<string>& args) const;
+  int combine(const string& hostInput, const string& output,
+              HipBinTaskRunner* runner, bool verbose, string& out) const;
+  int optimizeSpirv(const vector<string>& targets, vector<string>& inputs,
+                    HipBinTaskRunner* runner, bool verbose,
+                    string& out) const;
+  int compileNative(vector<string>& targets, vector<string>& inputs,
+                    HipBinTaskRunner* runner, bool verbose,
+                    string& out) const;
+  bool isFresh(const string& bundle, const string& compiler) const;
+};
+
+HipBinSplitCompile::HipBinSplitCompile(const string& bundler,
+                                       const string& tmpDir,
+                                       HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr), bundler_(bundler), tmpDir_(tmpDir) {}
+
+HipBinSplitCompile::~HipBinSplitCompile() {
+#if !defined(_WIN32) && !defined(_WIN64)
+  if (sharedFd_ >= 0)
+    close(sharedFd_);
+#endif
+}
+
+// compiles the source preprocessed once, from a memfd where available
+void HipBinSplitCompile::sharePreprocessedSource() {
+#if defined(__linux__)
+  sharedFd_ = memfd_create("hipcc-source", 0);
+  if (sharedFd_ >= 0) {
+    sharedSource_ = "/proc/" + std::to_string(getpid()) + "/fd/" +
+                    std::to_string(sharedFd_);
+    return;
+  }
+#endif
+  sharedSource_ = (fs::path(tmpDir_) / "source.hip").string();
+}
+
+bool HipBinSplitCompile::isRdc(const vector<string>& args) {
+  bool rdc = false;
+  for (auto& arg : args) {
+    if (arg == "-fgpu-rdc")
+      rdc = true;
+    else if (arg == "-fno-gpu-rdc")
+      rdc = false;
+  }
+  return rdc;
+}
+
+// the targets of --offload-arch= and --cuda-gpu-arch=, in order
+vector<string> HipBinSplitCompile::offloadArchs(const vector<string>& args) {
+  static const vector<string> archOpts = { "--offload-arch=",
+                                           "--cuda-gpu-arch=" };
+  vector<string> archs;
+  for (auto& arg : args) {
+    for (auto& opt : archOpts) {
+      if (arg.compare(0, opt.size(), opt) == 0 && arg.size() > opt.size() &&
+          std::find(archs.begin(), archs.end(), arg.substr(opt.size())) ==
+          archs.end())
+        archs.push_back(arg.substr(opt.size()));
+    }
+  }
+  return archs;
+}
+
+// true when splitting the compile can run anything in parallel: the host
+// half of a -fgpu-rdc compile, or the device code of several targets
+bool HipBinSplitCompile::applies(const vector<string>& args) {
+  for (auto& arg : args) {
+    if (arg.compare(0, 17, "--no-offload-arch") == 0)
+      return false;
+  }
+  return isRdc(args) || offloadArchs(args).size() > 1;
+}
+
+string HipBinSplitCompile::quoteArgs(const vector<string>& args) const {
+  string cmd;
+  for (auto& arg : args)
+    cmd += (cmd.empty() ? "" : " ") + hipBinUtilPtr_->quoteArg(arg);
+  return cmd;
+}
+
+// separates the output and dependency options of a compile from the rest
+void HipBinSplitCompile::splitArgs(const vector<string>& args,
+                                   const HipCCJob& job, vector<string>& common,
+                                   vector<string>& depArgs) {
+  static const vector<string> depValueOpts = { "-MF", "-MT", "-MQ" };
+  for (size_t i = 0; i < args.size(); i++) {
+    const string& arg = args[i];
+    if (arg == "-o" && i + 1 < args.size()) {
+      i++;
+    } else if (arg == "-o" + job.output) {
+      continue;
+    } else if (std::find(depValueOpts.begin(), depValueOpts.end(), arg) !=
+               depValueOpts.end() && i + 1 < args.size()) {
+      depArgs.push_back(arg);
+      depArgs.push_back(args[++i]);
+    } else if (arg == "-MD" || arg == "-MMD" || arg == "-MP") {
+      depArgs.push_back(arg);
+    } else {
+      common.push_back(arg);
+    }
+  }
+}
+
+// the -cuid option shared by the host and device compiles, empty when the
+// command chooses its own. It leaves out the targets, so the device objects
+// kept for HIPCC_DEVICE_REUSE stay valid when the target list changes.
+string HipBinSplitCompile::compilationUnitId(const vector<string>& args,
+                                             const vector<string>& common,
+                                             const HipCCJob& job) {
+  for (auto& arg : args) {
+    if (arg.compare(0, 6, "-cuid=") == 0 || arg == "-fuse-cuid=none")
+      return "";
+  }
+  HipBinHash hash;
+  std::error_code ec;
+  hash.update(fs::absolute(job.sources.at(0), ec).string());
+  for (auto& arg : common) {
+    if (offloadArchs({arg}).empty())
+      hash.update(arg);
+  }
+  return "-cuid=" + hash.hexDigest();
+}
+
+// builds the host and device compiles. The output and dependency options of
+// the command are kept for the host compile only, which writes the
+// dependency file for the real output.
+void HipBinSplitCompile::prepare(const string& cmdline, const HipCCJob& job,
+                                 const string& depFile,
+                                 const string& redirect) {
+  vector<string> args = hipBinUtilPtr_->splitCmdLine(cmdline);
+  vector<string> archs = offloadArchs(args);
+  vector<string> common, depArgs;
+  splitArgs(args, job, common, depArgs);
+  if (!depFile.empty() &&
+      std::find(depArgs.begin(), depArgs.end(), "-MF") == depArgs.end()) {
+    depArgs.push_back("-MF");
+    depArgs.push_back(depFile);
+  }
+  if (!depFile.empty() && job.depTarget.empty()) {
+    depArgs.push_back("-MT");
+    depArgs.push_back(job.output);
+  }
+  rdc_ = isRdc(args);
+  redirect_ = redirect;
+
+  cuid_ = compilationUnitId(args, common, job);
+  if (!cuid_.empty())
+    common.push_back(cuid_);
+  // the compiles which read the preprocessed source. The source has to be
+  // given as HIP, and precompiled headers already hold the runtime headers.
+  string language;
+  for (size_t i = 0; i + 1 < common.size() && common[i] != job.sources.at(0);
+       i++) {
+    if (common[i] == "-x")
+      language = common[i + 1];
+  }
+  if (language != "hip" || !pchs_.empty())
+    sharedSource_.clear();
+  vector<string> shared = common;
+  if (!sharedSource_.empty()) {
+    vector<string> preprocess = common;
+    preprocess.insert(preprocess.end(), depArgs.begin(), depArgs.end());
+    preprocess.insert(preprocess.end(), {"--cuda-host-only", "-E",
+                                         "-frewrite-includes", "-o", "-"});
+    preprocessTask_ = {quoteArgs(preprocess) + " > " +
+                       hipBinUtilPtr_->quoteArg(sharedSource_) + redirect, {}};
+    depArgs.clear();
+    std::error_code ec;
+    fs::path sourceDir = fs::absolute(job.sources.at(0), ec).parent_path();
+    std::replace(shared.begin(), shared.end(), job.sources.at(0),
+                 sharedSource_);
+    shared.insert(shared.end(), {"-iquote", sourceDir.string()});
+  }
+
+  // one device compile per target, or a single one for the default target
+  vector<string> deviceArgs, sharedDeviceArgs;
+  for (auto& arg : common) {
+    if (offloadArchs({arg}).empty())
+      deviceArgs.push_back(arg);
+  }
+  for (auto& arg : shared) {
+    if (offloadArchs({arg}).empty())
+      sharedDeviceArgs.push_back(arg);
+  }
+  if (archs.empty())
+    archs.push_back("");
+  string key;
+  if (!deviceObjectDir_.empty()) {
+    HipBinHash hash;
+    hash.update(HIPCC_DEVICE_OBJECT_VERSION);
+    for (auto& arg : deviceArgs)
+      hash.update(arg);
+    for (auto& name : hipccClangEnv) {
+      const char* value = std::getenv(name.c_str());
+      hash.update(name + "=" + (value ? value : ""));
+    }
+    key = hash.hexDigest();
+    // objects of earlier commands are not used again
+    std::error_code ec;
+    fs::create_directories(deviceObjectDir_, ec);
+    for (auto& entry : fs::directory_iterator(deviceObjectDir_, ec)) {
+      if (entry.path().filename().string().compare(0, key.size(), key) != 0)
+        fs::remove(entry.path(), ec);
+    }
+  }
+  for (auto& arch : archs) {
+    vector<string> device = arch.empty() ? shared : sharedDeviceArgs;
+    if (!key.empty())
+      device = arch.empty() ? common : deviceArgs;
+    if (!arch.empty())
+      device.push_back("--offload-arch=" + arch);
+    if (pchs_.count(arch))
+      device.insert(device.end(), {"-include-pch", pchs_.at(arch)});
+    if (key.empty()) {
+      deviceBundles_.push_back((fs::path(tmpDir_) / ("device-" +
+          std::to_string(deviceBundles_.size()) + ".o")).string());
+    } else {
+      string name = arch.empty() ? "default" : arch;
+      std::replace(name.begin(), name.end(), ':', '_');
+      deviceBundles_.push_back((fs::path(deviceObjectDir_) /
+                                (key + "-" + name + ".o")).string());
+      if (isFresh(deviceBundles_.back(), args.at(0)))
+        continue;
+      device.insert(device.end(), {"-MD", "-MF", deviceBundles_.back() + ".d",
+                                   "-MT", deviceBundles_.back()});
+    }
+    compiledBundles_.push_back(deviceBundles_.back());
+    device.insert(device.end(), {"--cuda-device-only", "--gpu-bundle-output",
+                                 "-o", deviceBundles_.back()});
+    deviceTasks_.push_back({quoteArgs(device) + redirect, {}});
+  }
+
+  vector<string> host = shared;
+  host.insert(host.end(), depArgs.begin(), depArgs.end());
+  host.push_back("--cuda-host-only");
+  if (pchs_.count("host"))
+    host.insert(host.end(), {"-include-pch", pchs_.at("host")});
+  if (rdc_) {
+    hostObject_ = (fs::path(tmpDir_) / "host.o").string();
+  } else {
+    hostObject_ = job.output;
+    host.insert(host.end(), {"-Xclang", "-fcuda-include-gpubinary",
+                             "-Xclang",
+                             (fs::path(tmpDir_) / "device.hipfb").string()});
+  }
+  host.insert(host.end(), {"-o", hostObject_});
+  hostTask_ = {quoteArgs(host) + redirect, {}};
+}
+
+// adds the device compile of another platform's command, for all of its
+// targets. Called after prepare, whose compilation unit id it shares.
+void HipBinSplitCompile::addDeviceCompile(const string& cmdline,
+                                          const HipCCJob& job) {
+  vector<string> common, depArgs;
+  splitArgs(hipBinUtilPtr_->splitCmdLine(cmdline), job, common, depArgs);
+  if (!cuid_.empty())
+    common.push_back(cuid_);
+  deviceBundles_.push_back((fs::path(tmpDir_) / ("device-" +
+      std::to_string(deviceBundles_.size()) + ".o")).string());
+  compiledBundles_.push_back(deviceBundles_.back());
+  common.insert(common.end(), {"--cuda-device-only", "--gpu-bundle-output",
+                               "-o", deviceBundles_.back()});
+  deviceTasks_.push_back({quoteArgs(common) + redirect_, {}});
+}
+
+// compiles the SPIR-V entries for the devices with the tool command, in
+// which @SPV@, @OUT@ and @DEVICE@ stand for the SPIR-V, the native binary
+// and the device name
+void HipBinSplitCompile::setNativeCompile(const string& tool,
+                                          const vector<string>& devices) {
+  nativeTool_ = tool;
+  nativeDevices_ = devices;
+}
+
+// runs the SPIR-V entries through the optimizer command, in which @IN@ and
+// @OUT@ stand for the module and the optimized module, keeping the results
+// in cacheDir when it is not empty
+void HipBinSplitCompile::setSpirvOptimizer(const string& optimizer,
+                                           const string& cacheDir) {
+  spirvOptimizer_ = optimizer;
+  spirvCacheDir_ = cacheDir;
+}
+
+// runs the compiles and writes the output
+int HipBinSplitCompile::run(HipBinTaskRunner* runner, const string& output,
+                            bool verbose, string& out) {
+  vector<HipccTask> tasks = deviceTasks_;
+  if (rdc_)
+    tasks.push_back(hostTask_);
+  if (!sharedSource_.empty()) {
+    tasks.insert(tasks.begin(), preprocessTask_);
+    for (size_t i = 1; i < tasks.size(); i++) {
+      if (tasks[i].cmd.find(sharedSource_) != string::npos)
+        tasks[i].deps.push_back(0);
+    }
+  }
+  if (verbose) {
+    for (auto& task : tasks)
+      cout << "hipcc-job: " << task.cmd << endl;
+  }
+  int exitCode = runner->run(tasks, out);
+  if (exitCode != 0) {
+    // a kept device object may be incomplete
+    std::error_code ec;
+    for (auto& bundle : compiledBundles_) {
+      fs::remove(bundle, ec);
+      fs::remove(bundle + ".d", ec);
+    }
+    return exitCode;
+  }
+  if (rdc_)
+    return combine(hostObject_, output, nullptr, verbose, out);
+
+  exitCode = combine("/dev/null",
+                     (fs::path(tmpDir_) / "device.hipfb").string(), runner,
+                     verbose, out);
+  if (exitCode != 0)
+    return exitCode;
+  if (verbose)
+    cout << "hipcc-job: " << hostTask_.cmd << endl;
+  return runner->run({hostTask_}, out);
+}
+
+// true when the kept device bundle is not older than the files of its
+// dependency file and the compiler
+bool HipBinSplitCompile::isFresh(const string& bundle,
+                                 const string& compiler) const {
+  std::error_code ec;
+  auto bundleTime = fs::last_write_time(bundle, ec);
+  if (ec)
+    return false;
+  vector<string> deps = hipBinUtilPtr_->parseDepFile(bundle + ".d");
+  if (deps.empty())
+    return false;
+  deps.push_back(compiler);
+  for (auto& dep : deps) {
+    auto depTime = fs::last_write_time(dep, ec);
+    if (ec || depTime > bundleTime)
+      return false;
+  }
+  return true;
+}
+
+// replaces the SPIR-V entries to bundle by their optimized modules, taken
+// from the cache or optimized in parallel
+int HipBinSplitCompile::optimizeSpirv(const vector<string>& targets,
+                                      vector<string>& inputs,
+                                      HipBinTaskRunner* runner, bool verbose,
+                                      string& out) const {
+  vector<HipccTask> tasks;
+  vector<std::pair<string, string>> results;  // optimized module, cached
+  for (size_t t = 0; t < targets.size(); t++) {
+    string module;
+    if (targets[t].find("-spirv64-") == string::npos ||
+        !hipBinUtilPtr_->readFile(inputs[t + 1], module))
+      continue;
+    HipBinHash hash;
+    hash.update(HIPCC_SPIRV_OPT_VERSION).update(spirvOptimizer_)
+        .update(module);
+    string cached = spirvCacheDir_.empty() ? "" :
+                    (fs::path(spirvCacheDir_) /
+                     (hash.hexDigest() + ".spv")).string();
+    std::error_code ec;
+    if (!cached.empty() && fs::exists(cached, ec)) {
+      if (verbose)
+        cout << "hipcc-spirv-opt: hit " << cached << endl;
+      inputs[t + 1] = cached;
+      continue;
+    }
+    string optimized = (fs::path(tmpDir_) / ("opt-" + std::to_string(t) +
+                        ".spv")).string();
+    string cmd = hipBinUtilPtr_->replaceAllStr(spirvOptimizer_, "@IN@",
+                 hipBinUtilPtr_->quoteArg(inputs[t + 1]));
+    cmd = hipBinUtilPtr_->replaceAllStr(cmd, "@OUT@",
+                                        hipBinUtilPtr_->quoteArg(optimized));
+    tasks.push_back({cmd + redirect_, {}});
+    results.push_back({optimized, cached});
+    inputs[t + 1] = optimized;
+  }
+  if (tasks.empty())
+    return 0;
+  if (verbose) {
+    for (auto& task : tasks)
+      cout << "hipcc-job: " << task.cmd << endl;
+  }
+  int exitCode = runner->run(tasks, out);
+  if (exitCode != 0)
+    return exitCode;
+  std::error_code ec;
+  if (!spirvCacheDir_.empty())
+    fs::create_directories(spirvCacheDir_, ec);
+  for (auto& result : results) {
+    string module;
+    if (!hipBinUtilPtr_->readFile(result.first, module))
+      return -1;
+    if (!result.second.empty())
+      hipBinUtilPtr_->writeFileAtomic(result.second, module);
+  }
+  return 0;
+}
+
+// adds the native binaries of the SPIR-V entries to the entries to bundle
+int HipBinSplitCompile::compileNative(vector<string>& targets,
+                                      vector<string>& inputs,
+                                      HipBinTaskRunner* runner, bool verbose,
+                                      string& out) const {
+  vector<HipccTask> tasks;
+  size_t entries = targets.size();
+  for (size_t t = 0; t < entries; t++) {
+    if (targets[t].find("-spirv64-") == string::npos)
+      continue;
+    for (auto& device : nativeDevices_) {
+      string binary = (fs::path(tmpDir_) / ("native-" + std::to_string(t) +
+                       "-" + device + ".bin")).string();
+      string cmd = hipBinUtilPtr_->replaceAllStr(nativeTool_, "@SPV@",
+                   hipBinUtilPtr_->quoteArg(inputs[t + 1]));
+      cmd = hipBinUtilPtr_->replaceAllStr(cmd, "@OUT@",
+                                          hipBinUtilPtr_->quoteArg(binary));
+      cmd = hipBinUtilPtr_->replaceAllStr(cmd, "@DEVICE@",
+                                          hipBinUtilPtr_->quoteArg(device));
+      tasks.push_back({cmd + redirect_, {}});
+      targets.push_back("hip-spir64_gen-unknown-unknown--" + device);
+      inputs.push_back(binary);
+    }
+  }
+  if (tasks.empty())
+    return 0;
+  if (verbose) {
+    for (auto& task : tasks)
+      cout << "hipcc-job: " << task.cmd << endl;
+  }
+  int exitCode = runner->run(tasks, out);
+  if (exitCode != 0)
+    return exitCode;
+  std::error_code ec;
+  for (size_t i = entries + 1; i < inputs.size(); i++) {
+    if (!fs::exists(inputs[i], ec))
+      return -1;
+  }
+  return 0;
+}
+
+// bundles the host input with the device entries of the device bundles,
+// optimized and with their native binaries when the runner is given
+int HipBinSplitCompile::combine(const string& hostInput, const string& output,
+                                HipBinTaskRunner* runner, bool verbose,
+                                string& out) const {
+  string hostTarget;
+  vector<string> targets, inputs = { hostInput };
+  for (size_t b = 0; b < deviceBundles_.size(); b++) {
+    const string& bundle = deviceBundles_[b];
+    SystemCmdOut list = hipBinUtilPtr_->exec((quoteArgs(
+        {bundler_, "-list", "-type=o", "-input=" + bundle}) +
+        redirect_).c_str());
+    if (list.exitCode != 0)
+      return list.exitCode;
+    vector<string> unbundle = { bundler_, "-unbundle", "-type=o",
+                                "-input=" + bundle };
+    string deviceTargets;
+    std::istringstream entries(list.out);
+    string entry;
+    while (std::getline(entries, entry)) {
+      entry = hipBinUtilPtr_->trim(entry);
+      if (entry.compare(0, 5, "host-") == 0) {
+        hostTarget = entry;
+      } else if (!entry.empty() &&
+                 std::find(targets.begin(), targets.end(), entry) ==
+                 targets.end()) {
+        string file = (fs::path(tmpDir_) / ("entry-" +
+                       std::to_string(targets.size()) + ".o")).string();
+        deviceTargets += (deviceTargets.empty() ? "" : ",") + entry;
+        unbundle.push_back("-output=" + file);
+        targets.push_back(entry);
+        inputs.push_back(file);
+      }
+    }
+    if (hostTarget.empty())
+      return -1;
+    if (deviceTargets.empty())
+      continue;
+    unbundle.push_back("-targets=" + deviceTargets);
+    int exitCode = hipBinUtilPtr_->exec((quoteArgs(unbundle) +
+                                         redirect_).c_str()).exitCode;
+    if (exitCode != 0)
+      return exitCode;
+  }
+  if (targets.empty())
+    return -1;
+  if (runner && !spirvOptimizer_.empty()) {
+    int exitCode = optimizeSpirv(targets, inputs, runner, verbose, out);
+    if (exitCode != 0)
+      return exitCode;
+  }
+  if (runner && !nativeTool_.empty()) {
+    int exitCode = compileNative(targets, inputs, runner, verbose, out);
+    if (exitCode != 0)
+      return exitCode;
+  }
+  string allTargets = hostTarget;
+  for (auto& target : targets)
+    allTargets += "," + target;
+  vector<string> bundle = { bundler_, "-type=o", "-targets=" + allTargets,
+                            "-output=" + output };
+  for (auto& input : inputs)
+    bundle.push_back("-input=" + input);
+  return hipBinUtilPtr_->exec((quoteArgs(bundle) + redirect_).c_str()).exitCode;
+}
+
+#endif  // SRC_HIPBIN_SPLIT_H_
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_TASKS_H_
+#define SRC_HIPBIN_TASKS_H_
+
+#include "hipBin_util.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+
+// A command of a compile split into several commands
+struct HipccTask {
+  string cmd;                   // shell command line
+  vector<size_t> deps;          // tasks which have to finish first
+};
+
+/**
+ * Runs the tasks of a compile with at most maxJobs of them at a time, each
+ * as soon as the tasks it depends on finished. The standard output of the
+ * tasks is returned in task order. When a task fails no new task is
+ * started and its exit code is returned.
+ */
+class HipBinTaskRunner {
+ public:
+  HipBinTaskRunner(int maxJobs, HipBinUtil* hipBinUtilPtr);
+  int run(const vector<HipccTask>& tasks, string& out);
+  static int defaultJobs(const string& jobsEnv);
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  size_t maxJobs_;
+};
+
+HipBinTaskRunner::HipBinTaskRunner(int maxJobs, HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr),
+    maxJobs_(maxJobs > 0 ? maxJobs : 1) {}
+
+// HIPCC_JOBS, or the number of hardware threads when it is not set
+int HipBinTaskRunner::defaultJobs(const string& jobsEnv) {
+  int jobs = std::atoi(jobsEnv.c_str());
+  if (jobs <= 0)
+    jobs = static_cast<int>(std::thread::hardware_concurrency());
+  return jobs > 0 ? jobs : 1;
+}
+
+int HipBinTaskRunner::run(const vector<HipccTask>& tasks, string& out) {
+  enum State { waiting, running, finished };
+  vector<State> states(tasks.size(), waiting);
+  vector<string> outputs(tasks.size());
+  std::mutex mutex;
+  std::condition_variable changed;
+  size_t numFinished = 0, numRunning = 0;
+  int exitCode = 0;
+
+  // returns the index of a task whose dependencies finished, or tasks.size()
+  auto nextReady = [&]() {
+    for (size_t i = 0; i < tasks.size(); i++) {
+      if (states[i] != waiting)
+        continue;
+      bool ready = true;
+      for (size_t dep : tasks[i].deps)
+        ready = ready && states.at(dep) == finished;
+      if (ready)
+        return i;
+    }
+    return tasks.size();
+  };
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      size_t task = tasks.size();
+      changed.wait(lock, [&]() {
+        if (exitCode != 0 || numFinished == tasks.size())
+          return true;
+        task = nextReady();
+        return task < tasks.size() ||
+               (numRunning == 0 && numFinished < tasks.size());
+      });
+      // stop on failure, completion or dependencies which can not finish
+      if (exitCode != 0 || task == tasks.size())
+        break;
+      states[task] = running;
+      numRunning++;
+      lock.unlock();
+      SystemCmdOut sysOut = hipBinUtilPtr_->exec(tasks[task].cmd.c_str());
+      lock.lock();
+      outputs[task] = sysOut.out;
+      states[task] = finished;
+      numRunning--;
+      numFinished++;
+      if (sysOut.exitCode != 0 && exitCode == 0)
+        exitCode = sysOut.exitCode;
+      changed.notify_all();
+    }
+    changed.notify_all();
+  };
+
+  vector<std::thread> workers;
+  for (size_t i = 0; i < std::min(maxJobs_, tasks.size()); i++)
+    workers.emplace_back(worker);
+  for (auto& thread : workers)
+    thread.join();
+  for (auto& output : outputs)
+    out += output;
+  if (exitCode == 0 && numFinished < tasks.size())
+    exitCode = -1;
+  return exitCode;
+}
+
+#endif  // SRC_HIPBIN_TASKS_H_
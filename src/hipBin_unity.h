@@ -0,0 +1,246 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SRC_HIPBIN_UNITY_H_
+#define SRC_HIPBIN_UNITY_H_
+
+#include "hipBin_util.h"
+#include "hipBin_job.h"
+#include <set>
+#include <vector>
+#include <string>
+
+# define HIPCC_UNITY_DEFAULT_SIZE  8
+
+/**
+ * Unity builds of the HIP sources of one invocation (--hipcc-unity[=N]).
+ *
+ * The .hip and .cu sources of a compile and link invocation are grouped
+ * into generated TUs which #include up to N of them, so the HIP runtime
+ * headers are parsed once per group instead of once per source. Sources
+ * whose internal linkage names (file scope statics and the contents of
+ * anonymous namespaces) collide are put into different groups. With clang
+ * the unity compile runs with -Werror=macro-redefined, so sources defining
+ * the same macro differently fail like colliding names do, after which the
+ * caller compiles the original sources. A macro one source defines and a
+ * later one of its group tests with #ifdef is not detected.
+ */
+class HipBinUnity {
+ public:
+  HipBinUnity(int maxSize, HipBinUtil* hipBinUtilPtr);
+  bool plan(const HipCCJob& job);
+  bool write(const string& dir);
+  string rewrite(const string& cmdline) const;
+
+ private:
+  HipBinUtil* hipBinUtilPtr_;
+  size_t maxSize_;
+  vector<vector<string>> groups_;
+  vector<string> unitySources_;
+  std::set<string> localNames(const string& text) const;
+};
+
+HipBinUnity::HipBinUnity(int maxSize, HipBinUtil* hipBinUtilPtr)
+  : hipBinUtilPtr_(hipBinUtilPtr),
+    maxSize_(maxSize > 0 ? maxSize : HIPCC_UNITY_DEFAULT_SIZE) {}
+
+// the names declared with internal linkage at namespace scope. Comments,
+// literals and preprocessor lines are skipped; a name is the last
+// identifier before the first "(", "=" or "[" of a declaration, or the
+// name of a class.
+std::set<string> HipBinUnity::localNames(const string& text) const {
+  // scopes: 'N' namespace or extern block, 'A' anonymous namespace,
+  // 'O' anything else
+  string scopes, statement;
+  std::set<string> names;
+  auto atNamespaceScope = [&]() {
+    return scopes.find('O') == string::npos;
+  };
+  auto declaredName = [&](const string& decl) {
+    std::smatch match;
+    if (std::regex_search(decl, match, regex("^(template\\s*<[^>]*>\\s*)?"
+        "(class|struct|union|enum(\\s+class)?)\\s+([A-Za-z_]\\w*)")))
+      return match[4].str();
+    size_t end = decl.find_first_of("(=[;{");
+    string head = decl.substr(0, end);
+    if (std::regex_search(head, match, regex("([A-Za-z_]\\w*)\\s*$")))
+      return match[1].str();
+    return string();
+  };
+  auto endStatement = [&](char terminator) {
+    string decl = hipBinUtilPtr_->trim(statement);
+    decl.erase(0, decl.find_first_not_of(" \n\r\t"));
+    statement.clear();
+    if (terminator == '{') {
+      bool isNamespace = std::regex_match(decl,
+                         regex("(inline\\s+)?namespace(\\s+[\\w:]+)?\\s*"));
+      bool isAnonymous = std::regex_match(decl,
+                         regex("(inline\\s+)?namespace\\s*"));
+      bool atScope = atNamespaceScope();
+      bool local = scopes.find('A') != string::npos ||
+                   std::regex_search(decl, regex("^static\\b"));
+      if (isAnonymous)
+        scopes += 'A';
+      else if (isNamespace || decl == "extern")
+        scopes += 'N';
+      else
+        scopes += 'O';
+      // a function, class or initializer body at namespace scope
+      if (!isNamespace && decl != "extern" && atScope && local &&
+          !declaredName(decl).empty())
+        names.insert(declaredName(decl));
+      return;
+    }
+    if (!atNamespaceScope() || decl.empty())
+      return;
+    bool local = scopes.find('A') != string::npos ||
+                 std::regex_search(decl, regex("^static\\b"));
+    if (local && !declaredName(decl).empty())
+      names.insert(declaredName(decl));
+  };
+
+  bool lineStart = true;
+  for (size_t i = 0; i < text.size(); i++) {
+    char c = text[i];
+    if (lineStart && c == '#') {
+      // preprocessor line, with continuations
+      while (i < text.size() && (text[i] != '\n' || text[i - 1] == '\\'))
+        i++;
+      continue;
+    }
+    if (c == '/' && i + 1 < text.size() && text[i + 1] == '/') {
+      while (i < text.size() && text[i] != '\n')
+        i++;
+      lineStart = true;
+      continue;
+    }
+    if (c == '/' && i + 1 < text.size() && text[i + 1] == '*') {
+      size_t end = text.find("*/", i + 2);
+      i = end == string::npos ? text.size() : end + 1;
+      continue;
+    }
+    if (c == '"' || c == '\'') {
+      for (i++; i < text.size() && text[i] != c; i++) {
+        if (text[i] == '\\')
+          i++;
+      }
+      continue;
+    }
+    if (c == '\n')
+      lineStart = true;
+    else if (!isspace(static_cast<unsigned char>(c)))
+      lineStart = false;
+    if (c == ';' || c == '{') {
+      endStatement(c);
+    } else if (c == '}') {
+      statement.clear();
+      if (!scopes.empty())
+        scopes.pop_back();
+    } else {
+      statement += c;
+    }
+  }
+  return names;
+}
+
+// groups the HIP sources of the job, false when no group has more than one
+// source
+bool HipBinUnity::plan(const HipCCJob& job) {
+  if (job.compileOnly || job.preprocessOnly || job.hasOpaqueArgs)
+    return false;
+  vector<std::set<string>> groupNames;
+  bool grouped = false;
+  for (auto& source : job.sources) {
+    string ext = fs::path(source).extension().string();
+    string text;
+    if ((ext != ".hip" && ext != ".cu") ||
+        !hipBinUtilPtr_->readFile(source, text))
+      continue;
+    std::set<string> names = localNames(text);
+    size_t g = 0;
+    for (; g < groups_.size(); g++) {
+      bool collides = false;
+      for (auto& name : names)
+        collides = collides || groupNames[g].count(name);
+      if (!collides && groups_[g].size() < maxSize_)
+        break;
+    }
+    if (g == groups_.size()) {
+      groups_.push_back({});
+      groupNames.push_back({});
+    }
+    groups_[g].push_back(source);
+    groupNames[g].insert(names.begin(), names.end());
+    grouped = grouped || groups_[g].size() > 1;
+  }
+  return grouped;
+}
+
+// writes the unity sources of the groups with more than one source
+bool HipBinUnity::write(const string& dir) {
+  for (size_t g = 0; g < groups_.size(); g++) {
+    if (groups_[g].size() < 2) {
+      unitySources_.push_back("");
+      continue;
+    }
+    string text = "// generated by hipcc --hipcc-unity\n";
+    for (auto& source : groups_[g]) {
+      std::error_code ec;
+      string path = fs::absolute(source, ec).string();
+      text += "#include \"" + hipBinUtilPtr_->replaceAllStr(path, "\\", "/") +
+              "\"\n";
+    }
+    unitySources_.push_back((fs::path(dir) /
+                             ("unity-" + std::to_string(g) + ".hip")).string());
+    if (!hipBinUtilPtr_->writeFileAtomic(unitySources_.back(), text))
+      return false;
+  }
+  return true;
+}
+
+// the command line with the first source of each group replaced by the
+// unity source and the other sources, with their "-x <language>", removed
+string HipBinUnity::rewrite(const string& cmdline) const {
+  vector<string> args = hipBinUtilPtr_->splitCmdLine(cmdline);
+  vector<string> out;
+  for (auto& arg : args) {
+    string replacement = arg;
+    for (size_t g = 0; g < groups_.size(); g++) {
+      const vector<string>& group = groups_[g];
+      if (unitySources_[g].empty() ||
+          std::find(group.begin(), group.end(), arg) == group.end())
+        continue;
+      replacement = arg == group.front() ? unitySources_[g] : "";
+    }
+    if (!replacement.empty()) {
+      out.push_back(replacement);
+    } else if (out.size() >= 2 && out[out.size() - 2] == "-x") {
+      out.resize(out.size() - 2);
+    }
+  }
+  string cmd;
+  for (auto& arg : out)
+    cmd += (cmd.empty() ? "" : " ") + hipBinUtilPtr_->quoteArg(arg);
+  return cmd;
+}
+
+#endif  // SRC_HIPBIN_UNITY_H_
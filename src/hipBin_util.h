@@ -99,12 +99,16 @@ namespace fs = std::filesystem;
 #include <regex>
 #include <algorithm>
 #include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 
 
 #if defined(_WIN32) || defined(_WIN64)
 #include <tchar.h>
 #include <windows.h>
 #include <io.h>
+#include <process.h>
 #ifdef _UNICODE
   typedef wchar_t TCHAR;
   typedef std::wstring TSTR;
@@ -118,6 +122,10 @@ namespace fs = std::filesystem;
 #endif
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 using std::cout;
@@ -140,6 +148,134 @@ struct SystemCmdOut {
   int exitCode = 0;
 };
 
+// 128-bit content hash used for cache keys and fingerprints. Bulk data goes
+// through four independent 64-bit lanes taking 32 byte stripes, in the style
+// of xxHash, which the compiler keeps in registers and pipelines so large
+// inputs hash at memory speed. Fields added with update(string) are length
+// prefixed so that concatenations can not collide.
+class HipBinHash {
+ public:
+  HipBinHash& update(const void* data, size_t size);
+  HipBinHash& update(const string& str);
+  string hexDigest() const;
+
+ private:
+  static const uint64_t prime1_ = 0x9e3779b185ebca87ULL;
+  static const uint64_t prime2_ = 0xc2b2ae3d27d4eb4fULL;
+  static const uint64_t prime3_ = 0x165667b19e3779f9ULL;
+  uint64_t lanes_[4] = { prime1_ + prime2_, prime2_, 0, 0 - prime1_ };
+  unsigned char stripe_[32];
+  size_t stripeSize_ = 0;
+  uint64_t total_ = 0;
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+  static uint64_t round(uint64_t lane, uint64_t input) {
+    return rotl(lane + input * prime2_, 31) * prime1_;
+  }
+  void consume(const unsigned char* stripes, size_t count);
+};
+
+void HipBinHash::consume(const unsigned char* stripes, size_t count) {
+  uint64_t v0 = lanes_[0], v1 = lanes_[1], v2 = lanes_[2], v3 = lanes_[3];
+  for (size_t i = 0; i < count; i++, stripes += 32) {
+    uint64_t in[4];
+    memcpy(in, stripes, sizeof(in));
+    v0 = round(v0, in[0]);
+    v1 = round(v1, in[1]);
+    v2 = round(v2, in[2]);
+    v3 = round(v3, in[3]);
+  }
+  lanes_[0] = v0, lanes_[1] = v1, lanes_[2] = v2, lanes_[3] = v3;
+}
+
+HipBinHash& HipBinHash::update(const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  total_ += size;
+  if (stripeSize_ > 0) {
+    size_t fill = std::min(size, sizeof(stripe_) - stripeSize_);
+    memcpy(stripe_ + stripeSize_, bytes, fill);
+    stripeSize_ += fill;
+    bytes += fill;
+    size -= fill;
+    if (stripeSize_ < sizeof(stripe_))
+      return *this;
+    consume(stripe_, 1);
+    stripeSize_ = 0;
+  }
+  consume(bytes, size / 32);
+  stripeSize_ = size % 32;
+  memcpy(stripe_, bytes + size - stripeSize_, stripeSize_);
+  return *this;
+}
+
+HipBinHash& HipBinHash::update(const string& str) {
+  uint64_t size = str.size();
+  update(&size, sizeof(size));
+  return update(str.data(), str.size());
+}
+
+string HipBinHash::hexDigest() const {
+  auto mix = [](uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  };
+  uint64_t h0 = rotl(lanes_[0], 1) + rotl(lanes_[1], 7) +
+                rotl(lanes_[2], 12) + rotl(lanes_[3], 18);
+  uint64_t h1 = rotl(lanes_[0], 23) ^ rotl(lanes_[1], 29) ^
+                rotl(lanes_[2], 37) ^ rotl(lanes_[3], 43);
+  h0 += total_;
+  h1 ^= total_ * prime3_;
+  for (size_t i = 0; i < stripeSize_; i++) {
+    h0 = rotl(h0 ^ (stripe_[i] * prime3_), 11) * prime1_;
+    h1 = rotl(h1 + stripe_[i] * prime1_, 17) * prime2_;
+  }
+  uint64_t words[2] = { mix(h0 ^ (h1 << 1)), mix(h1 + h0 * prime3_) };
+  static const char digits[] = "0123456789abcdef";
+  string hex;
+  for (uint64_t word : words) {
+    for (int shift = 60; shift >= 0; shift -= 4)
+      hex += digits[(word >> shift) & 0xf];
+  }
+  return hex;
+}
+
+// Advisory lock on a file, released when the object goes out of scope.
+// Used to serialize writers of shared cache directories. Locking is a no-op
+// on Windows.
+class HipBinFileLock {
+ public:
+  explicit HipBinFileLock(const string& path, bool wait = true);
+  ~HipBinFileLock();
+  bool locked() const { return locked_; }
+
+ private:
+  int fd_ = -1;
+  bool locked_ = false;
+};
+
+HipBinFileLock::HipBinFileLock(const string& path, bool wait) {
+#if defined(_WIN32) || defined(_WIN64)
+  locked_ = true;
+#else
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd_ >= 0)
+    locked_ = flock(fd_, LOCK_EX | (wait ? 0 : LOCK_NB)) == 0;
+#endif
+}
+
+HipBinFileLock::~HipBinFileLock() {
+#if !defined(_WIN32) && !defined(_WIN64)
+  if (fd_ >= 0) {
+    if (locked_)
+      flock(fd_, LOCK_UN);
+    close(fd_);
+  }
+#endif
+}
+
 
 class HipBinUtil {
  public:
@@ -151,15 +287,23 @@ class HipBinUtil {
   virtual ~HipBinUtil();
   // Common helper functions
   string getSelfPath() const;
+  string getSelfExe() const;
   vector<string> splitStr(string fullStr, char delimiter) const;
   string replaceStr(const string& s, const string& toReplace,
                     const string& replaceWith) const;
   string replaceRegex(const string& s, regex toReplace,
                       string replaceWith) const;
+  string replaceAllStr(const string& s, const string& toReplace,
+                       const string& replaceWith) const;
+  string normalizePath(const string& path) const;
+  string escapeField(const string& field) const;
+  string unescapeField(const string& field) const;
+  string quoteJson(const string& value) const;
   SystemCmdOut exec(const char* cmd, bool printConsole) const;
   string getTempDir();
   void deleteTempFiles();
   string mktempFile(string name);
+  string mkdtempDir(string name) const;
   string trim(string str) const;
   string readConfigMap(map<string, string> hipVersionMap,
                        string keyName, string defaultValue) const;
@@ -167,6 +311,14 @@ class HipBinUtil {
   bool substringPresent(string fullString, string subString) const;
   bool stringRegexMatch(string fullString, string pattern) const;
   bool checkCmd(const vector<string>& commands, const string& argument);
+  string quoteArg(const string& arg) const;
+  vector<string> splitCmdLine(const string& cmd) const;
+  vector<string> parseDepFile(const string& depFile) const;
+  bool readFile(const string& path, string& contents) const;
+  bool writeFileAtomic(const string& path, const string& contents) const;
+  string hashFile(const string& path) const;
+  string fileIdentity(const string& path) const;
+  void setEnv(const string& name, const string& value) const;
 
  private:
   HipBinUtil() {}
@@ -193,6 +345,18 @@ string HipBinUtil::mktempFile(string name) {
   return name;
 }
 
+// create a private temp directory with the template name, returns an empty
+// string on failure
+string HipBinUtil::mkdtempDir(string name) const {
+#if defined(_WIN32) || defined(_WIN64)
+  _mktemp(&name[0]);
+  std::error_code ec;
+  return fs::create_directory(name, ec) ? name : "";
+#else
+  return mkdtemp(&name[0]) ? name : "";
+#endif
+}
+
 // gets the path of the executable name
 string HipBinUtil::getSelfPath() const {
   int MAX_PATH_CHAR = 1024;
@@ -221,6 +385,17 @@ string HipBinUtil::getSelfPath() const {
   return path;
 }
 
+// gets the full path of the running executable
+string HipBinUtil::getSelfExe() const {
+  #if defined(_WIN32) || defined(_WIN64)
+    TCHAR buffer[MAX_PATH] = { 0 };
+    GetModuleFileName(NULL, buffer, MAX_PATH);
+    TSTR wide = TSTR(buffer);
+    return string(wide.begin(), wide.end());
+  #else
+    return fs::canonical("/proc/self/exe").string();
+  #endif
+}
 
 // removes the empty spaces and end lines
 string HipBinUtil::trim(string str) const {
@@ -259,6 +434,99 @@ string HipBinUtil::replaceStr(const string& s, const string& toReplace,
   return out.replace(pos, toReplace.length(), replaceWith);
 }
 
+// replaces every occurrence of the toReplace string with replaceWith string
+string HipBinUtil::replaceAllStr(const string& s, const string& toReplace,
+                                 const string& replaceWith) const {
+  if (toReplace.empty())
+    return s;
+  string out;
+  size_t start = 0, pos;
+  while ((pos = s.find(toReplace, start)) != string::npos) {
+    out.append(s, start, pos - start).append(replaceWith);
+    start = pos + toReplace.size();
+  }
+  return out.append(s, start, string::npos);
+}
+
+// removes ".", ".." and repeated or trailing separators from the path
+// without touching the file system, so symlinks are kept
+string HipBinUtil::normalizePath(const string& path) const {
+  if (path.empty())
+    return path;
+  vector<string> parts;
+  bool absolute = path[0] == '/' || path[0] == '\\';
+  string part;
+  for (size_t i = 0; i <= path.size(); i++) {
+    if (i < path.size() && path[i] != '/' && path[i] != '\\') {
+      part += path[i];
+      continue;
+    }
+    if (part == ".." && !parts.empty() && parts.back() != "..")
+      parts.pop_back();
+    else if (part == ".." && !absolute)
+      parts.push_back(part);
+    else if (!part.empty() && part != "." && part != "..")
+      parts.push_back(part);
+    part.clear();
+  }
+  string out = absolute ? "/" : "";
+  for (size_t i = 0; i < parts.size(); i++)
+    out += (i ? "/" : "") + parts[i];
+  return out.empty() ? "." : out;
+}
+
+// escapes tabs, newlines and backslashes so that the field can be stored
+// in tab separated, line based files
+string HipBinUtil::escapeField(const string& field) const {
+  string out;
+  for (char c : field) {
+    if (c == '\\')
+      out += "\\\\";
+    else if (c == '\t')
+      out += "\\t";
+    else if (c == '\n')
+      out += "\\n";
+    else
+      out += c;
+  }
+  return out;
+}
+
+string HipBinUtil::unescapeField(const string& field) const {
+  string out;
+  for (size_t i = 0; i < field.size(); i++) {
+    if (field[i] == '\\' && i + 1 < field.size()) {
+      char next = field[++i];
+      out += next == 't' ? '\t' : next == 'n' ? '\n' : next;
+    } else {
+      out += field[i];
+    }
+  }
+  return out;
+}
+
+// the value as a JSON string literal
+string HipBinUtil::quoteJson(const string& value) const {
+  string out = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '\t') {
+      out += "\\t";
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", static_cast<int>(c));
+      out += code;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
 // replaces the toReplace regex pattern with replaceWith string.
 // Returns the new string
 string HipBinUtil::replaceRegex(const string& s, regex toReplace,
@@ -376,5 +644,213 @@ bool HipBinUtil::checkCmd(const vector<string>& commands,
 }
 
 
+// quotes the argument so that the shell passes it through unchanged
+string HipBinUtil::quoteArg(const string& arg) const {
+  #if defined(_WIN32) || defined(_WIN64)
+    return "\"" + regex_replace(arg, regex("\""), "\\\"") + "\"";
+  #else
+    if (!arg.empty() &&
+        arg.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
+                              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                              "0123456789-_=+,./:@%") == string::npos)
+      return arg;
+    string quoted = "'";
+    for (char c : arg) {
+      if (c == '\'')
+        quoted += "'\\''";
+      else
+        quoted += c;
+    }
+    return quoted + "'";
+  #endif
+}
+
+// splits a shell command line into arguments, undoing the quoting done by
+// quoteArg and by the platforms when they construct the command
+vector<string> HipBinUtil::splitCmdLine(const string& cmd) const {
+  vector<string> args;
+  string current;
+  bool inArg = false;
+  for (size_t i = 0; i < cmd.size(); i++) {
+    char c = cmd[i];
+    if (c == ' ' || c == '\t' || c == '\n') {
+      if (inArg)
+        args.push_back(current);
+      current.clear();
+      inArg = false;
+    } else if (c == '\'') {
+      inArg = true;
+      size_t end = cmd.find('\'', i + 1);
+      if (end == string::npos)
+        end = cmd.size();
+      current += cmd.substr(i + 1, end - i - 1);
+      i = end;
+    } else if (c == '"') {
+      inArg = true;
+      for (i++; i < cmd.size() && cmd[i] != '"'; i++) {
+        if (cmd[i] == '\\' && i + 1 < cmd.size() &&
+            string("\"\\$`").find(cmd[i + 1]) != string::npos)
+          i++;
+        current += cmd[i];
+      }
+    } else if (c == '\\' && i + 1 < cmd.size()) {
+      inArg = true;
+      current += cmd[++i];
+    } else {
+      inArg = true;
+      current += c;
+    }
+  }
+  if (inArg)
+    args.push_back(current);
+  return args;
+}
+
+// returns the prerequisites listed in a make style dependency file as
+// written by -MD/-MF
+vector<string> HipBinUtil::parseDepFile(const string& depFile) const {
+  vector<string> deps;
+  string contents;
+  if (!readFile(depFile, contents))
+    return deps;
+  string current;
+  bool afterColon = false;
+  for (size_t i = 0; i < contents.size(); i++) {
+    char c = contents[i];
+    if (c == '\\' && i + 1 < contents.size()) {
+      char next = contents[i + 1];
+      if (next == '\n' || next == '\r') {  // line continuation
+        c = ' ';
+        i++;
+        if (next == '\r' && i + 1 < contents.size() && contents[i + 1] == '\n')
+          i++;
+      } else if (next == ' ' || next == '#' || next == '\\') {
+        current += next;
+        i++;
+        continue;
+      }
+    } else if (c == '$' && i + 1 < contents.size() && contents[i + 1] == '$') {
+      current += '$';
+      i++;
+      continue;
+    }
+    if (c == ':' && !afterColon &&
+        (i + 1 == contents.size() || isspace(contents[i + 1]))) {
+      afterColon = true;
+      current.clear();
+    } else if (isspace(static_cast<unsigned char>(c))) {
+      if (afterColon && !current.empty())
+        deps.push_back(current);
+      current.clear();
+      if (c == '\n')
+        afterColon = false;
+    } else {
+      current += c;
+    }
+  }
+  if (afterColon && !current.empty())
+    deps.push_back(current);
+  return deps;
+}
+
+// reads the whole file, returns false if it can not be read
+bool HipBinUtil::readFile(const string& path, string& contents) const {
+  ifstream in(path, std::ios::binary);
+  if (!in.is_open())
+    return false;
+  stringstream buffer;
+  buffer << in.rdbuf();
+  contents = buffer.str();
+  return true;
+}
+
+// writes the file through a temporary in the same directory and renames it
+// into place, so readers never see a partially written file
+bool HipBinUtil::writeFileAtomic(const string& path,
+                                 const string& contents) const {
+  string tmpPath = path + ".tmp" + std::to_string(getpid()) + "_" +
+                   std::to_string(rand());
+  {
+    ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+      return false;
+    out.write(contents.data(), contents.size());
+    if (!out.good()) {
+      out.close();
+      fs::remove(tmpPath);
+      return false;
+    }
+  }
+  try {
+    fs::rename(tmpPath, path);
+  } catch (...) {
+    fs::remove(tmpPath);
+    return false;
+  }
+  return true;
+}
+
+// hashes the file contents, returns an empty string if it can not be read
+string HipBinUtil::hashFile(const string& path) const {
+  HipBinHash hash;
+#if !defined(_WIN32) && !defined(_WIN64)
+  // large inputs (objects, archives, the compiler) are mapped instead of
+  // copied through a buffer
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return "";
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= (1 << 20)) {
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      hash.update(data, st.st_size);
+      munmap(data, st.st_size);
+      close(fd);
+      return hash.hexDigest();
+    }
+  }
+  vector<char> buffer(1 << 16);
+  ssize_t bytes;
+  while ((bytes = read(fd, buffer.data(), buffer.size())) > 0)
+    hash.update(buffer.data(), static_cast<size_t>(bytes));
+  close(fd);
+  if (bytes < 0)
+    return "";
+#else
+  ifstream in(path, std::ios::binary);
+  if (!in.is_open())
+    return "";
+  vector<char> buffer(1 << 16);
+  while (in) {
+    in.read(buffer.data(), buffer.size());
+    hash.update(buffer.data(), static_cast<size_t>(in.gcount()));
+  }
+#endif
+  return hash.hexDigest();
+}
+
+// identifies a file by path, size and modification time without reading it,
+// used for the compiler binary the same way ccache does by default
+string HipBinUtil::fileIdentity(const string& path) const {
+  std::error_code ec;
+  auto size = fs::file_size(path, ec);
+  if (ec)
+    return path;
+  auto mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+  return path + ":" + std::to_string(size) + ":" + std::to_string(mtime);
+}
+
+// sets the environment variable, an empty value removes it
+void HipBinUtil::setEnv(const string& name, const string& value) const {
+  #if defined(_WIN32) || defined(_WIN64)
+    _putenv_s(name.c_str(), value.c_str());
+  #else
+    if (value.empty())
+      unsetenv(name.c_str());
+    else
+      setenv(name.c_str(), value.c_str(), 1);
+  #endif
+}
 
 #endif  // SRC_HIPBIN_UTIL_H_